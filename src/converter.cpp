@@ -0,0 +1,34 @@
+// Meshes one frame of an SVO recording into Mesh.ply, needs the ZED SDK.
+// Usage: Converter <file.svo> [max_error], a max_error in metres merges
+// flat regions.
+
+// Sources first, converter.hpp pulls the cv and sl namespaces in
+#include "./impl/mesh.cpp"
+#include "./impl/ply_writer.cpp"
+#include "./impl/point_cloud.cpp"
+#include "./headers/converter.hpp"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <file.svo> [max_error]\n";
+        return 1;
+    }
+
+    try {
+        dm::CameraManager manager;
+        dm::CameraManager::Params parameters;
+        if (argc > 2) parameters.mesh_error = std::atof(argv[2]);
+        manager.setParams(parameters);
+        manager.initSVO(argv[1]);
+        if (manager.openCamera() != sl::ERROR_CODE::SUCCESS) return 1;
+        if (manager.grab() != sl::ERROR_CODE::SUCCESS) return 1;
+
+        manager.imageProcessing();
+        manager.depthMapProcessing();
+        manager.pointCloudProcessing(true);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << " in method 'main'\n";
+        return 1;
+    }
+    return 0;
+}
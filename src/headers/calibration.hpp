@@ -0,0 +1,110 @@
+#ifndef CALIBRATION_HPP
+#define CALIBRATION_HPP
+
+#include <array>
+#include <chrono>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+// Finds the white calibration area the projector lights up in gray camera
+// images.
+//
+// One frame costs a min/max and mean pass, a threshold halfway between the
+// mean and the brightest pixel and a single connected component labeling;
+// the largest component wins. A detection is accepted once it agrees with
+// the previous ones for a few frames in a row, and the search gives up
+// after its time budget.
+class CalibrationDetector {
+   public:
+    struct Parameters {
+        int min_area = 15000;                    // pixels
+        std::chrono::milliseconds budget{5000};  // 0 is unlimited
+        int stable_frames = 3;    // consecutive agreeing detections
+        double tolerance = 0.02;  // of the box size and area to agree
+        int min_contrast = 20;    // between darkest and brightest pixel
+    };
+
+    enum Status { SEARCHING, CONVERGED, TIMED_OUT };
+
+    struct Detection {
+        cv::Mat mask;  // CV_8U, 255 on the calibration area
+        cv::Rect bbox;
+        int area = 0;
+        int threshold = 0;
+    };
+
+   private:
+    using clock = std::chrono::steady_clock;
+
+    Parameters m_parameters;
+    clock::time_point m_started;
+    int m_frames = 0;
+    int m_stable = 0;
+    Detection m_detection;
+
+    // Reused between frames
+    cv::Mat m_binary;
+    cv::Mat m_labels;
+    cv::Mat m_stats;
+    cv::Mat m_centroids;
+
+   public:
+    CalibrationDetector(Parameters parameters);
+
+    // Starts over, including the time budget
+    void reset();
+
+    Status feed(const cv::Mat &gray);
+    // The last detection turned out unusable, it has to converge again
+    void reject() { m_stable = 0; }
+
+    const Detection &detection() const { return m_detection; }
+    int frames() const { return m_frames; }
+    std::chrono::milliseconds elapsed() const;
+
+   private:
+    bool detect(const cv::Mat &gray, Detection &detection);
+    bool agrees(const Detection &current, const Detection &previous) const;
+};
+
+// Quadrilateral the calibration area forms in the camera image.
+//
+// The corners come from the convex hull simplified to four vertices, then
+// each side is refit with a robust line through every contour point along
+// it and the corners are moved to where neighbouring lines intersect, which
+// puts them at sub-pixel accuracy even when the lit corners are rounded.
+struct QuadFit {
+    static constexpr double MIN_SCORE = 0.95;
+
+    bool found = false;
+    // top-left, top-right, bottom-right, bottom-left
+    std::array<cv::Point2f, 4> corners;
+    double score = 0;     // intersection over union of quad and mask
+    double residual = 0;  // rms distance of the contour to the sides, px
+
+    bool good() const { return found && score >= MIN_SCORE; }
+};
+
+// Fits the largest blob of a binary CV_8U mask
+QuadFit fitQuad(const cv::Mat &mask);
+
+// Last calibration of a camera, so a restart can skip the white screen
+// when the camera still sees what it saw back then. One gzip compressed
+// FileStorage file with base64 matrices.
+struct CalibrationCache {
+    static constexpr int VERSION = 1;
+
+    std::string serial;  // of the camera it belongs to
+    cv::Size resolution;
+    cv::Mat homography;
+    cv::Mat roi;
+    cv::Mat reference;  // depth thumbnail, see MovementDetector
+
+    // Throws if the file cannot be written
+    void save(std::string path) const;
+    // False if there is no usable cache at path
+    bool load(std::string path);
+};
+
+#endif  // CALIBRATION_HPP
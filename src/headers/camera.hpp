@@ -7,13 +7,31 @@
 #include <string>
 
 #include "../../include/sl_utils.hpp"
+#include "../headers/frame_source.hpp"
+#include "../headers/object_recognition.hpp"
 #include "../headers/settings.hpp"
-#include "../impl/object_recognition.cpp"
-#include "../impl/utils.cpp"
+#include "../headers/slot_ring.hpp"
+#include "../headers/utils.hpp"
 
 namespace zed {
 
 class CameraManager {
+   public:
+    // Views of one retrieved frame; every cv::Mat wraps the memory of the
+    // sl::Mat next to it, which the slot owns
+    struct FrameSlot {
+        sl::Mat color;    // U8_C4
+        sl::Mat gray;     // U8_C1
+        sl::Mat depth;    // U8_C4
+        sl::Mat measure;  // F32_C1, metres
+        cv::Mat color_cv;
+        cv::Mat gray_cv;
+        cv::Mat depth_cv;
+        cv::Mat measure_cv;
+    };
+    using FrameLease = SlotRing<FrameSlot>::Lease;
+
+   private:
     Printer m_printer;
     Printer::DEBUG_LVL m_prod = Printer::DEBUG_LVL::PRODUCTION;
     Printer::ERROR m_info = Printer::ERROR::INFO;
@@ -24,18 +42,16 @@ class CameraManager {
     sl::RuntimeParameters m_runParams;
     sl::Resolution m_resolution;
     int m_svo_pos;
-    HoughLinesPsets m_hough_params;
 
     bool m_isGrabbed;
 
+    // Retrieved frames, recycled once downstream stages drop their lease
+    SlotRing<FrameSlot> m_frames;
+    // How long a retrieve waits for the pipeline to hand a slot back
+    const std::chrono::milliseconds m_slot_timeout{100};
+
    public:
-    sl::Mat *image_color;
-    cv::Mat image_color_cv;
-    sl::Mat *image_gray;
-    cv::Mat image_gray_cv;
-    sl::Mat *image_depth;
-    cv::Mat image_depth_cv;
-    sl::Mat *image_mask;
+    sl::Mat image_mask;
     cv::Mat image_mask_cv;
 
     cv::Mat homography;
@@ -53,34 +69,22 @@ class CameraManager {
         setRunParams(config);
         m_isGrabbed = false;
 
-        image_color =
-            new sl::Mat(m_resolution, sl::MAT_TYPE::U8_C4, sl::MEM::CPU);
-        image_color_cv = slMat2cvMat(*image_color);
-        image_gray =
-            new sl::Mat(m_resolution, sl::MAT_TYPE::U8_C1, sl::MEM::CPU);
-        image_gray_cv = slMat2cvMat(*image_gray);
-        image_depth =
-            new sl::Mat(m_resolution, sl::MAT_TYPE::U8_C4, sl::MEM::CPU);
-        image_depth_cv = slMat2cvMat(*image_depth);
-        // image_mask =
-        //     new sl::Mat(m_resolution, sl::MAT_TYPE::U8_C1, sl::MEM::CPU);
-        // image_mask_cv = slMat2cvMat(*image_mask);
+        // One slot being retrieved, one being prepared, the rest queued.
+        // Slots allocate their views on first use and keep them.
+        m_frames.reserve(config.queue_depth + 2);
+
         image_mask_cv =
-            cv::Mat::ones(m_resolution.height, m_resolution.height, CV_8U);
+            cv::Mat::ones(m_resolution.height, m_resolution.width, CV_8U);
     }
 
+    // Frame slots survive, leases held downstream stay valid
     void restartCamera(Config config) {
         m_zed.close();
         openCam(config);
-        // TODO destroy some things?
     }
 
     void updateRunParams(Config config) { setRunParams(config); }
 
-    void updateHough(HoughLinesPsets hough_params) {
-        m_hough_params = hough_params;
-    }
-
     sl::ERROR_CODE grab() {
         auto returned_state = m_zed.grab(m_runParams);
         if (returned_state == sl::ERROR_CODE::SUCCESS)
@@ -91,155 +95,163 @@ class CameraManager {
         return sl::ERROR_CODE::SUCCESS;
     }
 
-    void imageProcessing(bool write = false) {
+    // Time since the last grabbed image was exposed
+    std::chrono::nanoseconds frameAge() {
+        auto image =
+            m_zed.getTimestamp(sl::TIME_REFERENCE::IMAGE).getNanoseconds();
+        auto current =
+            m_zed.getTimestamp(sl::TIME_REFERENCE::CURRENT).getNanoseconds();
+
+        // recorded SVO timestamps are not comparable with the current time
+        std::chrono::nanoseconds age(current - image);
+        if (age < std::chrono::nanoseconds(0) || age > std::chrono::seconds(1))
+            return std::chrono::nanoseconds(0);
+        return age;
+    }
+
+    // Retrieves the views in the FrameSource::View mask into a free slot.
+    // The slot is the caller's until the lease is dropped; empty if the
+    // pipeline held on to every slot for too long.
+    FrameLease imageProcessing(bool write = false,
+                               uint32_t views = FrameSource::ALL_VIEWS) {
         if (!m_zed.isOpened()) throw("Camera is not opened");
         if (!m_isGrabbed) throw("Frame is not grabbed");
 
-        m_zed.retrieveImage(*image_color, sl::VIEW::LEFT, sl::MEM::CPU,
-                            m_resolution);
-        m_zed.retrieveImage(*image_gray, sl::VIEW::LEFT_GRAY, sl::MEM::CPU,
-                            m_resolution);
-        m_zed.retrieveImage(*image_depth, sl::VIEW::DEPTH);
+        FrameLease slot = m_frames.acquire(m_slot_timeout);
+        if (!slot) return nullptr;
+
+        if (views & FrameSource::COLOR) {
+            allocate(slot->color, slot->color_cv, sl::MAT_TYPE::U8_C4);
+            m_zed.retrieveImage(slot->color, sl::VIEW::LEFT, sl::MEM::CPU,
+                                m_resolution);
+        }
+        if (views & FrameSource::GRAY) {
+            allocate(slot->gray, slot->gray_cv, sl::MAT_TYPE::U8_C1);
+            m_zed.retrieveImage(slot->gray, sl::VIEW::LEFT_GRAY, sl::MEM::CPU,
+                                m_resolution);
+        }
+        if (views & FrameSource::DEPTH) {
+            allocate(slot->depth, slot->depth_cv, sl::MAT_TYPE::U8_C4);
+            m_zed.retrieveImage(slot->depth, sl::VIEW::DEPTH, sl::MEM::CPU,
+                                m_resolution);
+        }
+        if (views & FrameSource::METRIC_DEPTH) {
+            allocate(slot->measure, slot->measure_cv, sl::MAT_TYPE::F32_C1);
+            m_zed.retrieveMeasure(slot->measure, sl::MEASURE::DEPTH,
+                                  sl::MEM::CPU, m_resolution);
+        }
 
         if (write) {
-            if ((*image_color)
-                    .write(("capture_" + std::to_string(m_svo_pos) + ".png")
-                               .c_str()) == sl::ERROR_CODE::SUCCESS)
+            if ((views & FrameSource::COLOR) &&
+                slot->color.write(
+                    ("capture_" + std::to_string(m_svo_pos) + ".png")
+                        .c_str()) == sl::ERROR_CODE::SUCCESS)
                 m_printer.log_message(
                     {m_succ, {}, "color image saving", m_prod});
-            if ((*image_depth)
+            if ((views & FrameSource::DEPTH) && slot->depth
                     .write(
                         ("capture_depth_" + std::to_string(m_svo_pos) + ".png")
                             .c_str()) == sl::ERROR_CODE::SUCCESS)
                 m_printer.log_message(
                     {m_succ, {}, "depth image saving", m_prod});
         }
+        return slot;
     }
 
-    void calibrate(std::string window_name, InteractiveState &state,
-                   std::string save_location, int min_area) {
-        // TODO provide keyboard controller
-        if (!m_zed.isOpened()) throw("Camera is not opened");
+    sl::Resolution resolution() const { return m_resolution; }
 
-        Logger logger;
-        ImageProcessor imageProcessor(save_location, logger, m_printer);
+    // Of the left view at the resolution frames are retrieved at
+    CameraIntrinsics intrinsics() {
+        auto configuration = m_zed.getCameraInformation(m_resolution)
+                                 .camera_configuration;
+        auto left = configuration.calibration_parameters.left_cam;
+        return {left.fx, left.fy, left.cx, left.cy};
+    }
+    uint64_t starvedFrames() const { return m_frames.starved(); }
+
+    // True once a new homography and ROI are in place
+    bool calibrate(OutputSink &sink, InteractiveState &state,
+                   std::string save_location,
+                   CalibrationDetector::Parameters parameters) {
+        if (!m_zed.isOpened()) throw("Camera is not opened");
 
         cv::Mat white(m_resolution.height, m_resolution.width, CV_8UC4,
                       cv::Scalar(255, 255, 255, 255));
 
-        cv::imshow(window_name, white);
-        state.key = cv::waitKey(100);
-        int biggestMaskIdx = 0;
-        while (state.calibrate) {
-            imageProcessor.pruneMasks();
-            cout << "Calibrating!" << endl;
-            cv::imshow(window_name, white);
-            state.key = cv::waitKey(100);
+        // Give the projector time to actually show it once
+        sink.show(white);
+        state.key = state.readKey(100);
+
+        CalibrationDetector detector(parameters);
+        auto status = CalibrationDetector::SEARCHING;
+        while (state.calibrate && status == CalibrationDetector::SEARCHING) {
+            sink.show(white);
+            state.key = state.readKey(1);
             state.action();
 
             auto returned_state = grab();
             if (returned_state != sl::ERROR_CODE::SUCCESS)
                 throw("Frame is not grabbed");
-            m_zed.retrieveImage(*image_gray, sl::VIEW::LEFT_GRAY, sl::MEM::CPU,
-                                m_resolution);
-
-            double alpha = 3.0;
-            int beta = 0;
-
-            cv::Mat normalized_image =
-                cv::Mat::zeros(image_gray_cv.size(), image_gray_cv.type());
-            // for (int y = 0; y < image_gray_cv.rows; y++) {
-            //     for (int x = 0; x < image_gray_cv.cols; x++) {
-            //         if (image_gray_cv.at<uchar>(y, x) > 255 - beta) {
-            //             normalized_image.at<uchar>(y, x) = 255;
-            //         } else {
-            //             normalized_image.at<uchar>(y, x) =
-            //                 cv::saturate_cast<uchar>(
-            //                     alpha * image_gray_cv.at<uchar>(y, x) +
-            //                     beta);
-            //         }
-            //     }
-            // }
-            // cv::adaptiveThreshold(image_gray_cv, normalized_image, 255,
-            //                       ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY, 7,
-            //                       0);
-            // cv::Scalar scr(1, 1, 1, 1);
-            // scr.col(0)
-
-            auto mean = cv::mean(image_gray_cv)[0];
-            std::cout << mean << std::endl;
-            // cv::threshold(image_gray_cv, normalized_image, mean + 20, 255,
-            //               ThresholdTypes::THRESH_BINARY);
-
-            imwrite("./Result/input_init.png", image_gray_cv);
-            imwrite("./Result/input_norm.png", normalized_image);
-
-            int value = 0;
-            int max = 0;
-            int x = 0;
-            int y = 0;
-            int nRows = m_resolution.height;
-            int nCols = m_resolution.width;
-            for (int i = 0; i < nRows * nCols; i++) {
-                x = i % nCols;
-                y = i / nCols;
-
-                value = (int)image_gray_cv.at<uchar>(y, x);
-                if (value > max) max = value;
-            }
-
-            imageProcessor.getImage(&image_gray_cv);
-            Config cfg{.z_limit = 10,
-                       .min_distance = uchar(max - uchar((max - mean) / 2)),
-                       .medium_limit = 10,
-                       .min_area = min_area,
-                       .max_objects = 4,
-                       .recurse = false};
-            imageProcessor.setParametersFromSettings(cfg);
-            imageProcessor.findObjects();
-
-            int area = 0;
-            int max_area = 0;
-            for (int i = 0; i < imageProcessor.mask_mats.size(); i++) {
-                area = imageProcessor.mask_mats.at(i).area;
-                if (area > max_area) {
-                    max_area = area;
-                    biggestMaskIdx = i;
-                }
-            }
-
-            std::cout << std::endl << max_area << std::endl;
-
-            if (max_area < min_area) {
-                continue;
-            } else {
-                image_mask_cv =
-                    imageProcessor.mask_mats.at(biggestMaskIdx).mat.clone();
-                try {
-                    deduceHomography();
-                    state.calibrate = false;
-                    break;
-                } catch (const std::exception &e) {
-                    std::cerr << e.what() << '\n';
-                    continue;
-                }
+            FrameLease slot = imageProcessing(false, FrameSource::GRAY);
+            if (!slot) continue;
+
+            status = detector.feed(slot->gray_cv);
+            if (status != CalibrationDetector::CONVERGED) continue;
+
+            image_mask_cv = detector.detection().mask.clone();
+            try {
+                deduceHomography();
+                state.calibrate = false;
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << '\n';
+                detector.reject();
+                status = CalibrationDetector::SEARCHING;
             }
         }
 
-        if (state.calibrate) {
-            imageProcessor.pruneMasks();
-            (*image_mask) = cvMat2slMat(image_mask_cv);
-            (*image_mask).write((save_location + "ROI_mask.png").c_str());
-            m_zed.setRegionOfInterest(*image_mask);
-        }
+        m_printer.log_message(
+            {Printer::INFO_CALIBRATION,
+             {detector.frames(), int(detector.elapsed().count()),
+              detector.detection().area},
+             status == CalibrationDetector::CONVERGED ? "converged"
+             : status == CalibrationDetector::TIMED_OUT ? "timed out"
+                                                         : "aborted",
+             m_prod});
+
+        if (status != CalibrationDetector::CONVERGED) return false;
+        applyRegionOfInterest();
+        image_mask.write((save_location + "ROI_mask.png").c_str());
+        return true;
     }
 
-    ~CameraManager() {
-        // TODO cleanup sl::Mat pointers
-        m_zed.close();
+    void restoreCalibration(const cv::Mat &new_homography,
+                            const cv::Mat &roi) {
+        homography = new_homography.clone();
+        image_mask_cv = roi.clone();
+        applyRegionOfInterest();
     }
 
+    std::string serial() {
+        return std::to_string(m_zed.getCameraInformation().serial_number);
+    }
+
+    ~CameraManager() { m_zed.close(); }
+
    private:
+    void applyRegionOfInterest() {
+        image_mask = cvMat2slMat(image_mask_cv);
+        m_zed.setRegionOfInterest(image_mask);
+    }
+
+    // Only new slots and resolution changes allocate
+    void allocate(sl::Mat &mat, cv::Mat &view, sl::MAT_TYPE type) {
+        if (mat.isInit() && mat.getResolution() == m_resolution &&
+            mat.getDataType() == type)
+            return;
+        mat.alloc(m_resolution, type, sl::MEM::CPU);
+        view = slMat2cvMat(mat);
+    }
+
     // TODO error??
     void setInitParams(Config config) {
         m_initParams.depth_mode =
@@ -280,187 +292,98 @@ class CameraManager {
         if (config.type == Config::SOURCE_TYPE::SVO) initSVO();
     }
 
+    // Maps the calibration area onto the whole projector image
     void deduceHomography() {
-        cv::Mat border;
-        cv::Canny(image_mask_cv, border, 30, 100);
-        int width = image_mask_cv.cols;
-        int height = image_mask_cv.rows;
-
-        cv::Mat out(image_mask_cv);
-        vector<Point> found_corners;
-        auto returned_status = findCorners(out, found_corners);
-
-        if (returned_status != sl::ERROR_CODE::SUCCESS) {
-            imwrite("./Result/input.png", out);
-            throw std::runtime_error("Failed to find corners");
-        }
-
-        vector<Point> default_corners = {Point(width, 0), Point(width, height),
-                                         Point(0, 0), Point(0, height)};
-
-        int dist_threshold = 10;
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; i < 4; i++) {
-                if (i == j) continue;
-
-                auto p1 = found_corners.at(i);
-                auto p2 = found_corners.at(j);
-                if ((abs(p1.x - p2.x) < dist_threshold) &&
-
-                    (abs(p1.y - p2.y) < dist_threshold))
-                    throw runtime_error("Points too close");
-            }
-        }
-
-        auto distance2 = [](cv::Point A, cv::Point B) -> double {
-            return ((A.x - B.x) * (A.x - B.x) + (A.y - B.y) * (A.y - B.y));
-        };
-
-        vector<Point> sorted_found_corners(4, Point(0, 0));
-        array<optional<int>, 4> indices;
-
-        for (int d_idx = 0; d_idx < default_corners.size(); d_idx++) {
-            auto def_point = default_corners.at(d_idx);
-            double min_dist = INT32_MAX;
-            for (int f_idx = 0; f_idx < found_corners.size(); f_idx++) {
-                auto found_point = found_corners.at(f_idx);
-                double distance = distance2(def_point, found_point);
-
-                if (distance == min_dist)
-                    throw runtime_error("Bad point location");
-                if (distance < min_dist) {
-                    min_dist = distance;
-                    indices.at(d_idx) = f_idx;
-                }
-            }
-        }
+        QuadFit fit = fitQuad(image_mask_cv);
+        if (!fit.good())
+            throw std::runtime_error(
+                "Calibration area is not a quadrilateral (fit " +
+                std::to_string(int(fit.score * 100)) + "%)");
+
+        float width = m_resolution.width;
+        float height = m_resolution.height;
+        std::array<cv::Point2f, 4> projector = {
+            cv::Point2f(0, 0), cv::Point2f(width, 0),
+            cv::Point2f(width, height), cv::Point2f(0, height)};
+        homography =
+            cv::getPerspectiveTransform(fit.corners.data(), projector.data());
+
+        m_printer.log_message({Printer::INFO,
+                               {int(fit.score * 100)},
+                               "quad fit (%)",
+                               Printer::DEBUG_LVL::BRIEF});
+        m_printer.log_message({Printer::INFO,
+                               {int(fit.residual * 100)},
+                               "quad residual (px / 100)",
+                               Printer::DEBUG_LVL::BRIEF});
+    }
+};
 
-        std::cout << "Indices: ";
-        for (auto index : indices) {
-            if (index) std::cout << *index << "; ";
-        }
-        std::cout << "\n";
+// Live ZED camera behind the FrameSource interface
+class ZedFrameSource : public FrameSource {
+    CameraManager m_camera;
 
-        // TODO check if points are consecutive
-        for (int i = 0; i < indices.size(); i++) {
-            if (indices.at(i)) {
-                sorted_found_corners.at(i) = found_corners.at(*indices.at(i));
-            }
-        }
-
-        std::cout << "Points before: ";
-        for (auto point : found_corners) {
-            std::cout << "x: " << point.x << "y: " << point.y << "; ";
-        }
-        std::cout << "\n";
-        std::cout << "Points after: ";
-        for (auto point : sorted_found_corners) {
-            std::cout << "x: " << point.x << "y: " << point.y << "; ";
-        }
-        std::cout << "\n";
+   public:
+    ZedFrameSource(Printer printer) : m_camera(printer) {}
 
-        if (found_corners.size() == 4) {
-            homography = findHomography(sorted_found_corners, default_corners);
-        }
+    void open(Config config) override { m_camera.openCam(config); }
+    void restart(Config config) override { m_camera.restartCamera(config); }
 
-        imwrite("./Result/input.png", out);
+    void updateRunParams(Config config) override {
+        m_camera.updateRunParams(config);
     }
 
-    Vec3f calcParams(Point2f p1,
-                     Point2f p2)  // line's equation Params computation
-    {
-        float a, b, c;
-        if (p2.y - p1.y == 0) {
-            a = 0.0f;
-            b = -1.0f;
-        } else if (p2.x - p1.x == 0) {
-            a = -1.0f;
-            b = 0.0f;
-        } else {
-            a = (p2.y - p1.y) / (p2.x - p1.x);
-            b = -1.0f;
-        }
-
-        c = (-a * p1.x) - b * p1.y;
-        return (Vec3f(a, b, c));
+    bool grab() override {
+        return m_camera.grab() == sl::ERROR_CODE::SUCCESS;
     }
 
-    Point findIntersection(Vec3f params1, Vec3f params2) {
-        float x = -1, y = -1;
-        float det = params1[0] * params2[1] - params2[0] * params1[1];
-        if (det < 0.5f && det > -0.5f)  // lines are approximately parallel
-        {
-            return (Point(-1, -1));
-        } else {
-            x = (params2[1] * -params1[2] - params1[1] * -params2[2]) / det;
-            y = (params1[0] * -params2[2] - params2[0] * -params1[2]) / det;
-        }
-        return (Point(x, y));
+    bool retrieve(SourceFrame &frame, uint32_t views = ALL_VIEWS) override {
+        frame.captured =
+            FrameTimestamps::clock::now() -
+            std::chrono::duration_cast<FrameTimestamps::clock::duration>(
+                m_camera.frameAge());
+        CameraManager::FrameLease slot = m_camera.imageProcessing(false, views);
+        if (!slot) return false;
+        countRetrieval(views);
+
+        frame.depth = views & DEPTH ? slot->depth_cv : cv::Mat();
+        frame.gray = views & GRAY ? slot->gray_cv : cv::Mat();
+        frame.color = views & COLOR ? slot->color_cv : cv::Mat();
+        frame.metric_depth =
+            views & METRIC_DEPTH ? slot->measure_cv : cv::Mat();
+        frame.buffers = slot;
+        return true;
     }
 
-    sl::ERROR_CODE findCorners(cv::Mat &out, vector<Point> &corners) {
-        // Guaranteed to have one shape at this point
-        int width = image_mask_cv.cols;
-        int height = image_mask_cv.rows;
-
-        Mat image_hull(height, width, CV_8UC1);
-        image_hull = Scalar(0);
-
-        vector<vector<Point>> contours(1);
-        vector<vector<Point>> hull(1);
-        findContours(image_mask_cv, contours, RETR_EXTERNAL, CHAIN_APPROX_NONE);
-        convexHull(Mat(contours.at(0)), hull[0], false);
-
-        vector<Vec4i> lines;
-        drawContours(image_hull, hull, 0, Scalar(255));
-        imwrite("./Result/hull.png", image_hull);
-        cv::HoughLinesP(
-            image_hull, lines, m_hough_params.rho,
-            CV_PI / m_hough_params.theta_denom, m_hough_params.threshold,
-            m_hough_params.min_line_length, m_hough_params.max_line_gap);
-        cout << "lines size:" << lines.size() << endl;
-
-        cv::Mat img_with_lines = out;
-        for (size_t i = 0; i < lines.size(); i++) {
-            Vec4i l = lines[i];
-            line(img_with_lines, Point(l[0], l[1]), Point(l[2], l[3]),
-                 Scalar(122, 122, 122), 3, LINE_AA);
-        }
-        imwrite("./Result/lines.png", img_with_lines);
-
-        if (lines.size() == 4)  // we found the 4 sides
-        {
-            vector<Vec3f> params(4);
-            for (int l = 0; l < 4; l++) {
-                params.push_back(calcParams(Point(lines[l][0], lines[l][1]),
-                                            Point(lines[l][2], lines[l][3])));
-            }
-
-            // vector<Point> corners;
-            for (int i = 0; i < params.size(); i++) {
-                for (int j = i; j < params.size();
-                     j++)  // j starts at i so we don't have duplicated
-                           // points
-                {
-                    Point intersec = findIntersection(params[i], params[j]);
-                    if ((intersec.x > 0) && (intersec.y > 0) &&
-                        (intersec.x < width) && (intersec.y < height)) {
-                        cout << "corner: " << intersec << endl;
-                        corners.push_back(intersec);
-                    }
-                }
-            }
-            for (int i = 0; i < corners.size(); i++) {
-                circle(out, corners[i], 3, Scalar(122, 122, 122));
-            }
+    bool calibrate(OutputSink &sink, InteractiveState &state,
+                   std::string save_location,
+                   CalibrationDetector::Parameters parameters) override {
+        return m_camera.calibrate(sink, state, save_location, parameters);
+    }
+    cv::Mat homography() override { return m_camera.homography; }
+    cv::Mat roi() override { return m_camera.image_mask_cv; }
+    CameraIntrinsics intrinsics() override { return m_camera.intrinsics(); }
+
+    std::string serial() override { return m_camera.serial(); }
+    void restoreCalibration(const cv::Mat &homography,
+                            const cv::Mat &roi) override {
+        m_camera.restoreCalibration(homography, roi);
+    }
 
-            if (corners.size() == 4)  // we have the 4 final corners
-            {
-                return sl::ERROR_CODE::SUCCESS;
-            }
+   protected:
+    size_t viewBytes(View view) override {
+        sl::Resolution resolution = m_camera.resolution();
+        size_t pixels = resolution.width * resolution.height;
+        switch (view) {
+            case GRAY:
+                return pixels;
+            case DEPTH:
+            case COLOR:
+            case METRIC_DEPTH:
+                return pixels * 4;
+            default:
+                return 0;
         }
-
-        return sl::ERROR_CODE::FAILURE;
     }
 };
 
@@ -0,0 +1,56 @@
+#ifndef DEPTH_QUANTIZER_HPP
+#define DEPTH_QUANTIZER_HPP
+
+#include "opencv2/opencv.hpp"
+
+// Turns single-channel float metric depth into the 8, 16 or 32 bit (float)
+// working image in one pass.
+//
+// Near objects get high values like in the rendered depth view. 0 is
+// reserved for pixels without usable depth: NaN, 0 and anything beyond
+// `far` (+inf included). Anything closer than `near` (-inf included)
+// saturates to the maximum. INVERSE spends the resolution on the near
+// range, where disparity based depth is accurate anyway.
+//
+// Float output stays metric: metres in front of `far` (LINEAR) or
+// 1/depth - 1/far (INVERSE).
+class DepthQuantizer {
+   public:
+    enum Mapping { LINEAR, INVERSE };
+
+    struct Parameters {
+        float near = 0.3f;  // metres
+        float far = 20.0f;
+        Mapping mapping = LINEAR;
+        int bits = 8;  // 8, 16 or 32 (float)
+    };
+
+   private:
+    Parameters m_parameters;
+
+   public:
+    DepthQuantizer() = default;
+    DepthQuantizer(Parameters parameters);
+
+    void setParameters(Parameters parameters);
+    Parameters parameters() const { return m_parameters; }
+    int outputType() const {
+        switch (m_parameters.bits) {
+            case 16:
+                return CV_16UC1;
+            case 32:
+                return CV_32FC1;
+            default:
+                return CV_8UC1;
+        }
+    }
+
+    // depth is CV_32FC1, out is reallocated only if its size or type differs
+    void quantize(const cv::Mat &depth, cv::Mat &out) const;
+
+    // The 8 or 16 bit image quantize() would have made of the metric depth
+    // behind a float working image of these parameters
+    void toInteger(const cv::Mat &working, int bits, cv::Mat &out) const;
+};
+
+#endif  // DEPTH_QUANTIZER_HPP
@@ -0,0 +1,77 @@
+#ifndef EVENTS_HPP
+#define EVENTS_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+
+// Wakes threads on explicit events instead of sleeping and polling flags.
+//
+// Every thread subscribes once and then blocks in wait() until one of the
+// events it is interested in was posted. Each subscriber has its own pending
+// set, so one post wakes everybody who cares. SHUTDOWN stays pending once
+// posted. Posts and wakeups are counted and traced at VERBOSE level.
+class EventBus {
+   public:
+    enum Event : uint32_t {
+        NONE = 0,
+        FRAME_GRABBED = 1 << 0,
+        RESULT_READY = 1 << 1,
+        SETTINGS_CHANGED = 1 << 2,
+        CALIBRATION_REQUESTED = 1 << 3,
+        CALIBRATION_DONE = 1 << 4,
+        SHUTDOWN = 1 << 5,
+    };
+    static constexpr int EVENT_COUNT = 6;
+
+   private:
+    struct Subscriber {
+        std::string name;
+        uint32_t pending = 0;
+        int wakeups = 0;
+    };
+
+    Printer m_printer;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+
+    std::vector<Subscriber> m_subscribers;
+    std::array<int, EVENT_COUNT> m_posted{};
+
+   public:
+    EventBus(Printer printer = Printer()) : m_printer(printer) {}
+
+    EventBus(const EventBus &) = delete;
+    EventBus &operator=(const EventBus &) = delete;
+
+    // Returns the id to wait with
+    int subscribe(std::string name);
+
+    void post(Event event);
+
+    // Blocks until any event from `interest` is pending, consumes and
+    // returns them
+    uint32_t wait(int subscriber, uint32_t interest);
+
+    // Same as wait(), but gives up after `timeout` and returns NONE
+    uint32_t waitFor(int subscriber, uint32_t interest,
+                     std::chrono::milliseconds timeout);
+
+    // Consumes pending events from `interest` without blocking
+    uint32_t poll(int subscriber, uint32_t interest);
+
+    void printStats();
+
+    static std::string name(Event event);
+
+   private:
+    uint32_t consume(Subscriber &subscriber, uint32_t interest);
+};
+
+#endif  // EVENTS_HPP
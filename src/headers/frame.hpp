@@ -0,0 +1,45 @@
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "latency.hpp"
+#include "object_recognition.hpp"
+#include "settings.hpp"
+#include "structured_light.hpp"
+
+// Frame travelling between pipeline stages
+struct Frame {
+    using clock = FrameTimestamps::clock;
+
+    uint64_t id = 0;
+    FrameTimestamps timestamps;
+    QualityLevel quality;               // chosen once per frame
+    std::chrono::microseconds work{0};  // busy time over all stages
+
+    cv::Mat depth;  // as retrieved, released once prepared
+    std::shared_ptr<const void> source;  // lease on depth, if borrowed
+    cv::Size size;                       // of depth, full resolution
+    cv::Mat roi;         // calibrated region of interest
+    cv::Mat homography;  // camera -> projector
+    RemapTable remap;    // camera -> projector, replaces homography if set
+
+    cv::Mat image;  // working image after warp and morphology
+    std::vector<ImageProcessor::MatWithInfo> objects;
+    cv::Mat labels;
+};
+
+// Everything the display side needs from one processed frame
+struct FrameResult {
+    uint64_t frame_id = 0;
+    FrameTimestamps timestamps;
+
+    std::vector<ImageProcessor::MatWithInfo> objects;
+    cv::Mat labels;
+    cv::Mat render;  // projector image prepared for the current mode
+};
+
+#endif  // FRAME_HPP
@@ -0,0 +1,204 @@
+#ifndef FRAME_SOURCE_HPP
+#define FRAME_SOURCE_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "calibration.hpp"
+#include "latency.hpp"
+#include "opencv2/opencv.hpp"
+#include "output_sink.hpp"
+#include "point_cloud.hpp"
+#include "recording.hpp"
+#include "settings.hpp"
+#include "utils.hpp"
+
+// Views of one frame delivered by a FrameSource, views that were not
+// requested are empty. With `buffers` set the matrices borrow source memory
+// that stays valid as long as some copy of `buffers` is held; otherwise
+// they are only valid until the next retrieve() on the same source.
+struct SourceFrame {
+    FrameTimestamps::clock::time_point captured;  // exposure, steady clock
+
+    cv::Mat depth;  // rendered depth view, BGRA or single channel
+    cv::Mat gray;
+    cv::Mat color;
+    cv::Mat metric_depth;  // CV_32FC1 metres, NaN and +-inf where unknown
+
+    std::shared_ptr<const void> buffers;  // lease on the source memory
+};
+
+// Anything that produces depth, gray and colour frames. Loop only talks to
+// this interface, so the pipeline runs the same on a live ZED camera and on
+// recorded sequences.
+class FrameSource {
+   public:
+    enum View : uint32_t {
+        DEPTH = 1 << 0,
+        GRAY = 1 << 1,
+        COLOR = 1 << 2,
+        METRIC_DEPTH = 1 << 3,
+        ALL_VIEWS = DEPTH | GRAY | COLOR | METRIC_DEPTH
+    };
+
+    // What retrieving only the requested views saved
+    struct RetrievalStats {
+        uint64_t frames = 0;
+        uint64_t fetched_bytes = 0;
+        uint64_t skipped_bytes = 0;
+    };
+
+    virtual ~FrameSource() = default;
+
+    virtual void open(Config config) = 0;
+    virtual void restart(Config config) {
+        close();
+        open(config);
+    }
+    virtual void close() {}
+
+    virtual void updateRunParams(Config) {}
+
+    // Blocks until the next frame is available
+    virtual bool grab() = 0;
+    // Fetches and converts only the views in the `views` mask
+    virtual bool retrieve(SourceFrame &frame, uint32_t views = ALL_VIEWS) = 0;
+    // True once a finite source has nothing left to deliver
+    virtual bool finished() { return false; }
+
+    // Establishes camera -> projector mapping and the region of interest,
+    // projecting its patterns through the sink. False if it did not.
+    virtual bool calibrate(OutputSink &sink, InteractiveState &state,
+                           std::string save_location,
+                           CalibrationDetector::Parameters parameters) = 0;
+    virtual cv::Mat homography() = 0;
+    virtual cv::Mat roi() = 0;
+
+    // Of the metric depth view, invalid if the source does not know them
+    virtual CameraIntrinsics intrinsics() { return {}; }
+
+    // Device a cached calibration belongs to, empty if this source does
+    // not take cached calibrations
+    virtual std::string serial() { return ""; }
+    // Adopts a cached homography and ROI instead of running calibrate()
+    virtual void restoreCalibration(const cv::Mat &, const cv::Mat &) {}
+
+    RetrievalStats retrievalStats() const { return m_retrieval; }
+
+   protected:
+    RetrievalStats m_retrieval;
+
+    // Bytes one view takes once fetched, 0 if the source has no such view
+    virtual size_t viewBytes(View) { return 0; }
+
+    void countRetrieval(uint32_t views) {
+        m_retrieval.frames++;
+        for (View view : {DEPTH, GRAY, COLOR, METRIC_DEPTH}) {
+            if (views & view)
+                m_retrieval.fetched_bytes += viewBytes(view);
+            else
+                m_retrieval.skipped_bytes += viewBytes(view);
+        }
+    }
+};
+
+// Camera views the consumers of captured frames need, and when they do.
+// Views nobody needs are never retrieved.
+class ViewDemand {
+   public:
+    struct Consumer {
+        std::string name;
+        uint32_t views;
+        std::function<bool()> active;
+    };
+
+   private:
+    std::vector<Consumer> m_consumers;
+
+   public:
+    ViewDemand() = default;
+    ViewDemand(std::vector<Consumer> consumers)
+        : m_consumers(std::move(consumers)) {}
+
+    // Those of the capture loop: segmentation, the recorder and the
+    // movement check, which also takes the reference a fresh calibration
+    // is saved with. Calibration retrieves the gray view by itself.
+    static ViewDemand capture(const InteractiveState &state,
+                              const Config &config,
+                              const bool &save_calibration);
+
+    // Depth comes quantized from the metric measure if asked to
+    uint32_t required(bool metric_depth) const;
+};
+
+// Replays a recorded sequence from a directory:
+//   depth_000000.png, ...   depth views (required)
+//   gray_000000.png, ...    gray views (optional)
+//   color_000000.png, ...   colour views (optional)
+//   metric_000000.tiff, ... float metric depth in metres (optional)
+//   timestamps.txt          exposure time per frame in ns (optional)
+//   intrinsics.yml          fx, fy, cx, cy of the metric depth (optional)
+//   homography.yml, roi.png calibration to replay with (optional)
+//
+// or from a .dgtr recording (see RecordingFormat), whose frames are mapped
+// rather than read and whose calibration follows the recorded frames.
+// Raw frames of a recording are delivered with a lease on the mapping.
+// Recordings carry no ROI, roi() stays empty for them. Without metric
+// depth on record, the recorded depth view is delivered in its place.
+//
+// Frames are delivered at their recorded pace, or as fast as they are
+// consumed with max_speed.
+class ReplayFrameSource : public FrameSource {
+    Printer m_printer;
+    std::string m_path;
+    bool m_max_speed = false;
+    std::shared_ptr<RecordingReader> m_recording;  // also the frame lease
+    int64_t m_calibration_id = -1;
+    bool m_has_gray = false;
+    bool m_has_color = false;
+    bool m_has_metric = false;
+    cv::Size m_depth_size;  // of the first frame, for the statistics
+    size_t m_depth_elem = 0;
+
+    int m_frame_count = 0;
+    int m_position = -1;
+    std::vector<long long> m_timestamps;  // ns, relative to the first frame
+    FrameTimestamps::clock::time_point m_started;
+    FrameTimestamps::clock::time_point m_captured;
+
+    cv::Mat m_homography;
+    cv::Mat m_roi;
+    CameraIntrinsics m_intrinsics;
+
+   public:
+    static constexpr long long DEFAULT_FRAME_NS = 1000000000LL / 30;
+
+    ReplayFrameSource(Printer printer) : m_printer(printer) {}
+
+    void open(Config config) override;
+
+    bool grab() override;
+    bool retrieve(SourceFrame &frame, uint32_t views = ALL_VIEWS) override;
+    bool finished() override;
+
+    bool calibrate(OutputSink &sink, InteractiveState &state,
+                   std::string save_location,
+                   CalibrationDetector::Parameters parameters) override;
+    cv::Mat homography() override { return m_homography; }
+    cv::Mat roi() override { return m_roi; }
+    CameraIntrinsics intrinsics() override { return m_intrinsics; }
+
+    // Delivery time of every frame in ns, relative to the first
+    const std::vector<long long> &timestamps() const { return m_timestamps; }
+
+   protected:
+    size_t viewBytes(View view) override;
+
+   private:
+    std::string framePath(std::string view, int index,
+                          std::string extension = "png");
+};
+
+#endif  // FRAME_SOURCE_HPP
@@ -0,0 +1,43 @@
+#ifndef KEY_SOURCE_HPP
+#define KEY_SOURCE_HPP
+
+#include <memory>
+#include <string>
+
+// Key input for InteractiveState, independent of where frames are shown.
+// read() follows cv::waitKey: timeout in ms, 0 blocks, -1 if nothing came.
+class KeySource {
+   public:
+    enum Type { WINDOW, TERMINAL, NONE };
+
+    virtual ~KeySource() = default;
+
+    virtual int read(int timeout) = 0;
+
+    // "window", "terminal" or "none"
+    static Type parse(std::string name);
+    static std::unique_ptr<KeySource> make(Type type);
+};
+
+// Keys pressed in the HighGUI window, also pumps its events
+class HighGuiKeySource : public KeySource {
+   public:
+    int read(int timeout) override;
+};
+
+// Single key presses on stdin, without echo or waiting for enter
+class TerminalKeySource : public KeySource {
+   public:
+    TerminalKeySource();
+    ~TerminalKeySource();
+
+    int read(int timeout) override;
+};
+
+// No input; the session ends by signal or when the source runs out
+class NoKeySource : public KeySource {
+   public:
+    int read(int timeout) override;
+};
+
+#endif  // KEY_SOURCE_HPP
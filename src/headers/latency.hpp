@@ -0,0 +1,79 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "utils.hpp"
+
+// Monotonic timestamps a frame collects on its way to the projector
+struct FrameTimestamps {
+    using clock = std::chrono::steady_clock;
+
+    // Every hop is stamped when it is finished
+    enum Hop {
+        GRAB,
+        RETRIEVE,
+        WARP,
+        MORPHOLOGY,
+        SEGMENTATION,
+        COMPOSITING,
+        IMSHOW,
+        HOP_COUNT
+    };
+
+    clock::time_point captured;  // image exposure, start of glass-to-glass
+    std::array<clock::time_point, HOP_COUNT> at{};
+
+    void mark(Hop hop) { at[hop] = clock::now(); }
+};
+
+// Rolling per-hop and glass-to-glass latency statistics.
+//
+// record() only stores a handful of numbers into fixed rings, percentiles
+// are computed when printing or dumping, so it is cheap enough to keep on.
+class LatencyTracer {
+   public:
+    static constexpr int WINDOW = 1024;                        // frames kept
+    static constexpr int SERIES = FrameTimestamps::HOP_COUNT + 1;  // + total
+    static constexpr int GLASS_TO_GLASS = FrameTimestamps::HOP_COUNT;
+
+    struct Percentiles {
+        int p50 = 0;
+        int p95 = 0;
+        int p99 = 0;
+        int max = 0;  // microseconds
+        int samples = 0;
+    };
+
+   private:
+    Printer m_printer;
+    std::chrono::seconds m_period;
+    FrameTimestamps::clock::time_point m_last_report;
+
+    std::mutex m_mutex;
+    std::array<std::array<int, WINDOW>, SERIES> m_samples;
+    int m_next = 0;
+    int m_filled = 0;
+    long m_frames = 0;
+
+   public:
+    // period of 0 disables periodic printing
+    LatencyTracer(Printer printer = Printer(), int period_seconds = 0);
+
+    void record(const FrameTimestamps &timestamps);
+
+    Percentiles percentiles(int series);
+
+    // Prints when the report period has passed since the last print,
+    // returns true if it did
+    bool report();
+    void print();
+    void dumpJson(std::string path);
+
+    static std::string name(int series);
+};
+
+#endif  // LATENCY_HPP
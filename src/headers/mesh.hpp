@@ -0,0 +1,96 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+// Indexed triangle mesh, vertices as the point clouds of BackProjector:
+// x, y, z and the RGBA colour packed into the fourth float
+struct Mesh {
+    std::vector<cv::Vec4f> vertices;
+    std::vector<cv::Vec3i> triangles;  // indices into vertices
+
+    void clear() {
+        vertices.clear();
+        triangles.clear();
+    }
+};
+
+// Triangulates an organised point cloud along its pixel grid.
+//
+// Every 2x2 block gives up to two triangles, upper left (v0, v1, v2) and
+// lower right (v1, v2, v3), each only if its three points are finite. Only
+// points some triangle uses become vertices, numbered in row order.
+//
+// All passes are linear and run in parallel over rows: finite points,
+// triangles per block, used points, then a prefix sum over the row counts
+// gives every row its place in the output so rows fill it independently.
+// Scratch buffers and the output keep their memory between frames.
+class GridMesher {
+    cv::Mat m_finite;     // CV_8U, per point
+    cv::Mat m_triangles;  // CV_8U, per block: 1 upper left, 2 lower right
+    cv::Mat m_index;      // CV_32S, vertex of every used point, else -1
+    std::vector<int> m_vertex_offsets;    // per row, exclusive prefix sum
+    std::vector<int> m_triangle_offsets;  // per block row
+
+   public:
+    enum Triangle : uchar { UPPER_LEFT = 1, LOWER_RIGHT = 2 };
+
+    // cloud is CV_32FC4, mesh is overwritten
+    void triangulate(const cv::Mat &cloud, Mesh &mesh);
+
+    // Vertex index per point of the last cloud, -1 where unused
+    const cv::Mat &vertexIndex() const { return m_index; }
+};
+
+// Triangulates an organised point cloud with as few triangles as flat
+// regions allow.
+//
+// The grid is cut into root squares of `root` pixels, each split into a
+// quadtree: a square becomes two triangles once all its points are finite
+// and none is further than `max_error` from the plane of the triangle above
+// it, otherwise it is split. Single pixel squares fall back to the
+// triangles of GridMesher. Where smaller squares meet a larger one, the
+// larger one is fanned from its centre through every vertex on its edges,
+// so the mesh has no cracks. Roots are processed in parallel; vertices are
+// numbered in row order as by GridMesher.
+class QuadtreeMesher {
+   public:
+    struct Parameters {
+        float max_error = 0.005f;  // cloud units, metres for BackProjector
+        int root = 64;             // pixels, a power of two
+    };
+
+   private:
+    struct Leaf {
+        int x, y, size;
+        bool fan;       // edges carry vertices of smaller neighbours
+        int triangles;  // emitted for this leaf
+    };
+
+    Parameters m_parameters;
+    cv::Mat m_finite;  // CV_8U, per point
+    cv::Mat m_index;   // CV_32S, vertex of every used point, else -1
+    std::vector<std::vector<Leaf>> m_leaves;  // per root
+    std::vector<int> m_vertex_offsets;        // per row
+    std::vector<int> m_triangle_offsets;      // per root
+
+   public:
+    QuadtreeMesher() = default;
+    QuadtreeMesher(Parameters parameters);
+
+    void setParameters(Parameters parameters);
+    Parameters parameters() const { return m_parameters; }
+
+    // cloud is CV_32FC4, mesh is overwritten
+    void triangulate(const cv::Mat &cloud, Mesh &mesh);
+
+   private:
+    bool flat(const cv::Mat &cloud, int x, int y, int size) const;
+    void split(const cv::Mat &cloud, int x, int y, int size,
+               std::vector<Leaf> &leaves);
+    void emit(const Leaf &leaf, cv::Vec3i *triangles) const;
+};
+
+#endif  // MESH_HPP
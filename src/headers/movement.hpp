@@ -0,0 +1,65 @@
+#ifndef MOVEMENT_HPP
+#define MOVEMENT_HPP
+
+#include "opencv2/opencv.hpp"
+
+// Notices when the camera itself moved since calibration.
+//
+// Every few frames the image is shrunk to a thumbnail and phase correlated
+// against the one taken right after calibration. Objects coming and going
+// change the content but do not shift all of it, only a global shift that
+// persists over several checks counts. A check costs one area resize and
+// a DFT of a few thousand pixels.
+class MovementDetector {
+   public:
+    struct Parameters {
+        int width = 64;             // thumbnail width, height keeps aspect
+        int every = 15;             // frames between checks
+        double max_shift = 1.0;     // thumbnail pixels that still count as
+                                    // standing still
+        double min_response = 0.1;  // weaker peaks say nothing about a shift
+        int sustained = 4;          // checks in a row before it counts
+    };
+
+   private:
+    Parameters m_parameters;
+    cv::Mat m_reference;  // CV_32F thumbnail, empty until the next frame
+    cv::Mat m_window;     // Hanning window against edge effects
+    cv::Mat m_thumbnail;
+    int m_frames = 0;
+    int m_moved = 0;  // consecutive checks over max_shift
+    cv::Point2d m_shift;
+
+   public:
+    MovementDetector();
+    MovementDetector(Parameters parameters);
+
+    // Also takes a new reference
+    void setParameters(Parameters parameters);
+
+    // The next observed frame becomes the reference, after calibration
+    void reset();
+
+    bool hasReference() const { return !m_reference.empty(); }
+    const cv::Mat &reference() const { return m_reference; }
+    void setReference(const cv::Mat &thumbnail);
+
+    // One check against the reference right away, true if the camera
+    // stands where it stood
+    bool matches(const cv::Mat &image);
+
+    // True once the camera moved; frames in between checks cost nothing
+    bool observe(const cv::Mat &image);
+
+    const Parameters &parameters() const { return m_parameters; }
+
+    // Last measured shift of the whole image, in its own pixels
+    cv::Point2d shift() const { return m_shift; }
+
+   private:
+    void shrink(const cv::Mat &image, cv::Mat &thumbnail);
+    // Shift against the reference, false if the peak is too weak to tell
+    bool measure(const cv::Mat &image, cv::Point2d &shift);
+};
+
+#endif  // MOVEMENT_HPP
@@ -1,6 +1,7 @@
 #ifndef OBJECT_RECOGNITION_HPP
 #define OBJECT_RECOGNITION_HPP
 
+#include <type_traits>
 #include <vector>
 
 #include "opencv2/highgui.hpp"
@@ -8,10 +9,12 @@
 #include "opencv2/opencv.hpp"
 #include "utils.hpp"
 
+// Depth thresholds are in steps of the working image, millimetres for float
+// (metric) depth
 struct Parameters {
-    uchar z_limit = 10;
-    uchar min_distance = 0;
-    uchar medium_limit = 10;
+    int z_limit = 10;
+    int min_distance = 0;
+    int medium_limit = 10;
     int min_area = 1000;
     int max_objects = 5;
     bool recurse = false;
@@ -31,7 +34,10 @@ class ImageProcessor {
 
     struct MatWithInfo {
         cv::Mat mat;
-        int area = 0;
+        int area = 0;             // pixels of the working image
+        double mean_depth = 0;    // working image units
+        cv::Rect bbox;            // in the space of mat, see describeMasks
+        cv::Point2f centroid;
     };
 
     std::vector<MatWithInfo> mask_mats;
@@ -65,8 +71,14 @@ class ImageProcessor {
 
     void findObjects();
 
+    // Moves found masks from camera to projector space via their contours
+    void warpMasks(const cv::Mat &homography, cv::Size size);
+
     void pruneMasks();
 
+    // Bounding boxes and centroids of the masks where they are now
+    void describeMasks();
+
    private:
     int directions[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
 
@@ -100,13 +112,33 @@ class ImageProcessor {
         }
     };
 
-    bool walk(cv::Mat &output, uchar prev_z, double &mediumVal, int x, int y,
-              uchar &id, int &visited, int &amount);
+    // Thresholds converted once to the type depth pixels are compared in
+    template <typename T>
+    struct Limits {
+        using Value = std::conditional_t<std::is_floating_point_v<T>, float,
+                                         int>;
+        Value z_limit;
+        Value min_distance;
+        Value medium_limit;
+    };
+
+    template <typename T>
+    Limits<T> limitsOf() const;
+
+    template <typename T>
+    void findObjectsOf();
+
+    template <typename T>
+    bool walk(cv::Mat &output, T prev_z, double &mediumVal, int x, int y,
+              uchar &id, int &visited, int &amount, const Limits<T> &limits);
 
-    void paint(cv::Point start, cv::Mat &output, uchar &id, Stats stats);
+    template <typename T>
+    void paint(cv::Point start, cv::Mat &output, uchar &id, Stats stats,
+               const Limits<T> &limits);
 
+    template <typename T>
     void iterate(cv::Point start, cv::Mat &output, int imageLeft, uchar &id,
-                 Stats stats);
+                 Stats stats, const Limits<T> &limits);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef OUTPUT_SINK_HPP
+#define OUTPUT_SINK_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+#include "utils.hpp"
+
+// Where the final projector frame goes. Only HighGuiSink needs a window
+// system; key input is handled by a KeySource independently.
+class OutputSink {
+   public:
+    enum Type { WINDOW, FILES, NONE };
+
+    virtual ~OutputSink() = default;
+
+    virtual void open() {}
+    virtual void show(const cv::Mat &image) = 0;
+    virtual void close() {}
+
+    uint64_t shown() const { return m_shown; }
+
+    // "window", "files" or "null"
+    static Type parse(std::string name);
+    static std::unique_ptr<OutputSink> make(Type type, std::string window_name,
+                                            std::string output_location);
+
+   protected:
+    uint64_t m_shown = 0;
+};
+
+// Full screen OpenCV window on the projector
+class HighGuiSink : public OutputSink {
+    std::string m_window_name;
+
+   public:
+    HighGuiSink(std::string window_name) : m_window_name(window_name) {}
+
+    void open() override;
+    void show(const cv::Mat &image) override;
+    void close() override;
+};
+
+// Raw frames for an external compositor, one file per frame:
+//   format.txt             "<width> <height> <channels>", 8 bit BGR(A) rows
+//   frame_000000.raw, ...  written under a temporary name and renamed, so
+//                          readers never see a partial frame
+class FileSequenceSink : public OutputSink {
+    std::string m_directory;
+    cv::Size m_size;
+    int m_channels = 0;
+
+   public:
+    FileSequenceSink(std::string directory) : m_directory(directory) {}
+
+    void open() override;
+    void show(const cv::Mat &image) override;
+
+   private:
+    void writeFormat();
+};
+
+// Drops every frame, for benchmarking the pipeline alone
+class NullSink : public OutputSink {
+   public:
+    void show(const cv::Mat &) override { m_shown++; }
+};
+
+#endif  // OUTPUT_SINK_HPP
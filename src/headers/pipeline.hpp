@@ -0,0 +1,108 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Bounded single-producer/single-consumer queue between two pipeline stages.
+//
+// With DropPolicy::LATEST a full queue discards its oldest element, so a
+// slow consumer always gets the most recent frames and latency stays capped
+// at `capacity` frames. With DropPolicy::BLOCK the producer waits instead.
+// Both sides block on a condition variable, nothing is polled.
+template <typename T>
+class BoundedQueue {
+   public:
+    enum DropPolicy { BLOCK, LATEST };
+
+   private:
+    std::deque<T> m_items;
+    size_t m_capacity;
+    DropPolicy m_policy;
+    bool m_closed = false;
+    size_t m_dropped = 0;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+
+   public:
+    BoundedQueue(size_t capacity = 2, DropPolicy policy = LATEST)
+        : m_capacity(capacity > 0 ? capacity : 1), m_policy(policy) {}
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    // Returns false if the queue was closed and the item was not accepted
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_policy == BLOCK)
+            m_not_full.wait(lock, [this] {
+                return m_closed || m_items.size() < m_capacity;
+            });
+        if (m_closed) return false;
+
+        while (m_items.size() >= m_capacity) {
+            m_items.pop_front();
+            m_dropped++;
+        }
+        m_items.push_back(std::move(item));
+        lock.unlock();
+
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    // Blocks until an item is available; false once closed and drained
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+        if (m_items.empty()) return false;
+
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        lock.unlock();
+
+        m_not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+    void setCapacity(size_t capacity) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_capacity = capacity > 0 ? capacity : 1;
+        }
+        m_not_full.notify_all();
+    }
+
+    void setPolicy(DropPolicy policy) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_policy = policy;
+        }
+        m_not_full.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_items.size();
+    }
+
+    size_t dropped() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+};
+
+#endif  // PIPELINE_HPP
@@ -0,0 +1,50 @@
+#ifndef PLY_WRITER_HPP
+#define PLY_WRITER_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mesh.hpp"
+#include "opencv2/opencv.hpp"
+
+// Binary little endian PLY: vertices as float x, y, z and uchar red,
+// green, blue; faces as a uchar 3 and three int indices.
+//
+// Vertices and faces come in chunks in any order, e.g. per block of meshed
+// rows. PLY wants all vertices first, so faces go to a side file that is
+// appended on close(), and the counts are patched into the header, whose
+// length does not depend on them. Records are packed into one buffer per
+// chunk and written at once.
+class PlyWriter {
+    std::ofstream m_file;
+    std::ofstream m_faces;
+    std::string m_path;
+    std::string m_faces_path;
+    uint64_t m_vertex_count = 0;
+    uint64_t m_face_count = 0;
+    std::vector<char> m_buffer;
+
+   public:
+    explicit PlyWriter(std::string path);
+    ~PlyWriter();
+
+    PlyWriter(const PlyWriter &) = delete;
+    PlyWriter &operator=(const PlyWriter &) = delete;
+
+    // Colour packed as by BackProjector
+    void writeVertices(const cv::Vec4f *vertices, size_t count);
+    // Indices count from the first vertex of the file
+    void writeFaces(const cv::Vec3i *faces, size_t count);
+    // The file is unreadable until then
+    void close();
+
+    uint64_t vertexCount() const { return m_vertex_count; }
+    uint64_t faceCount() const { return m_face_count; }
+
+    // Whole mesh at once, no side file
+    static void write(std::string path, const Mesh &mesh);
+};
+
+#endif  // PLY_WRITER_HPP
@@ -0,0 +1,142 @@
+#ifndef POINT_CLOUD_HPP
+#define POINT_CLOUD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+// Pinhole parameters of the view depth is measured in, pixels
+struct CameraIntrinsics {
+    float fx = 0;
+    float fy = 0;
+    float cx = 0;
+    float cy = 0;
+
+    bool valid() const { return fx > 0 && fy > 0; }
+    bool operator==(const CameraIntrinsics &other) const = default;
+};
+
+// Turns metric depth into an organised point cloud, right handed with y up
+// and the camera looking down -z like the ZED point clouds.
+//
+// Every pixel is depth times its ray, and rays separate into a factor per
+// column and one per row. Both tables are built once per intrinsics, so the
+// row kernel is a multiply per coordinate over raw rows. Rows run in
+// parallel. Pixels without depth give NaN points.
+class BackProjector {
+    CameraIntrinsics m_intrinsics;
+    cv::Size m_size;
+    std::vector<float> m_ray_x;  // (column - cx) / fx
+    std::vector<float> m_ray_y;  // -(row - cy) / fy
+
+   public:
+    BackProjector() = default;
+    BackProjector(CameraIntrinsics intrinsics, cv::Size size);
+
+    // Rebuilds the ray tables, a no-op if nothing changed
+    void setIntrinsics(CameraIntrinsics intrinsics, cv::Size size);
+    CameraIntrinsics intrinsics() const { return m_intrinsics; }
+    cv::Size size() const { return m_size; }
+
+    // depth is CV_32FC1 metres, color BGRA, BGR or empty. cloud becomes
+    // CV_32FC4 x, y, z and the colour packed as RGBA bytes into the fourth
+    // float, like sl::MEASURE::XYZRGBA; it is reallocated only if its size
+    // or type differs.
+    void project(const cv::Mat &depth, const cv::Mat &color,
+                 cv::Mat &cloud) const;
+};
+
+// Cache line aligned storage for vectorized loops. Elements are default
+// initialized, so resizing a reused array does not clear it first.
+template <typename T, size_t ALIGN = 64>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, ALIGN>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGN> &) {}
+
+    T *allocate(size_t count) {
+        return static_cast<T *>(
+            ::operator new(count * sizeof(T), std::align_val_t(ALIGN)));
+    }
+    void deallocate(T *data, size_t) {
+        ::operator delete(data, std::align_val_t(ALIGN));
+    }
+    template <typename U>
+    void construct(U *data) {
+        ::new (static_cast<void *>(data)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U *data, Args &&...args) {
+        ::new (static_cast<void *>(data)) U(std::forward<Args>(args)...);
+    }
+
+    bool operator==(const AlignedAllocator &) const { return true; }
+};
+
+// Unorganised point cloud as structure of arrays, one aligned array per
+// coordinate and the colour as RGBA bytes like BackProjector packs it
+struct PointCloud {
+    template <typename T>
+    using Array = std::vector<T, AlignedAllocator<T>>;
+
+    Array<float> x, y, z;
+    Array<uint32_t> rgba;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    void resize(size_t count) {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+        rgba.resize(count);
+    }
+    void clear() { resize(0); }
+};
+
+// Keeps the points of an organised CV_32FC4 cloud with finite coordinates,
+// in row order. Rows are compacted in parallel in one pass over the cloud,
+// then moved together.
+void filterFinite(const cv::Mat &cloud, PointCloud &points);
+
+// Downsamples to one point per occupied voxel: the centroid of its points
+// and their mean colour, voxels in the order they were first hit.
+//
+// Voxel coordinates are computed in parallel and packed into 64 bit keys,
+// 21 bits per axis; points further than 2^20 voxels from the origin and
+// non finite ones are dropped. Keys go into an open addressing table that
+// is kept between calls along with the other buffers.
+class VoxelGrid {
+    struct Sum {
+        double x, y, z;
+        uint64_t r, g, b;
+        uint32_t count;
+    };
+
+    float m_size;
+    std::vector<uint64_t> m_keys;   // per point
+    std::vector<uint64_t> m_table;  // open addressing, EMPTY if unused
+    std::vector<int> m_voxels;      // per table entry, index into m_sums
+    std::vector<Sum> m_sums;
+
+   public:
+    static constexpr uint64_t EMPTY = ~uint64_t(0);
+
+    explicit VoxelGrid(float size = 0.01f);
+
+    void setSize(float size);
+    float size() const { return m_size; }
+
+    void downsample(const PointCloud &points, PointCloud &out);
+};
+
+#endif  // POINT_CLOUD_HPP
@@ -0,0 +1,51 @@
+#ifndef QUALITY_HPP
+#define QUALITY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "settings.hpp"
+#include "utils.hpp"
+
+// Holds the processing time per frame under a budget.
+//
+// Walks down the configured quality ladder (index 0 is the best quality)
+// after a few frames over budget and back up after a longer stretch with
+// clear headroom, so it does not oscillate. Stages read the current level
+// once per frame; every transition is logged.
+class QualityController {
+    static constexpr int DOWN_AFTER = 5;   // frames over budget
+    static constexpr int UP_AFTER = 60;    // frames with headroom
+    static constexpr double HEADROOM = 0.7;
+    static constexpr double SMOOTHING = 0.2;
+
+    Printer m_printer;
+    mutable std::mutex m_mutex;  // ladder and budget change on reload
+    std::vector<QualityLevel> m_ladder;
+    std::chrono::microseconds m_target;
+
+    std::atomic<int> m_level{0};
+    double m_average = 0;  // smoothed frame time, microseconds
+    int m_over = 0;
+    int m_under = 0;
+
+   public:
+    // A target of 0 keeps the best level all the time
+    QualityController(Printer printer, std::vector<QualityLevel> ladder,
+                      int target_ms);
+
+    // Reloaded settings, the level is kept as far as the new ladder goes
+    void setLadder(std::vector<QualityLevel> ladder, int target_ms);
+
+    void observe(std::chrono::microseconds frame_time);
+
+    QualityLevel level() const;
+    int levelIndex() const { return m_level; }
+
+   private:
+    void step(int direction);
+};
+
+#endif  // QUALITY_HPP
@@ -0,0 +1,181 @@
+#ifndef RECORDING_HPP
+#define RECORDING_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "depth_quantizer.hpp"
+#include "latency.hpp"
+#include "opencv2/opencv.hpp"
+#include "pipeline.hpp"
+#include "utils.hpp"
+
+// Depth recording container (.dgtr)
+//
+//   Header                 fixed size, patched when the recording is closed
+//   frame payloads         each starts on a PAGE_ALIGN boundary
+//   IndexEntry[frames]     one per frame
+//   Calibration[count]     homographies the frames refer to by id
+//
+// Every frame is a single 8 or 16 bit depth plane. RAW payloads are the
+// plane itself and are handed out as views into the mapping. Delta payloads
+// hold the XOR against the previous frame, zero run-length or LZ4 coded,
+// and are decoded from the last keyframe.
+struct RecordingFormat {
+    static constexpr char MAGIC[8] = {'D', 'G', 'T', 'R', 'E', 'C', '0', '1'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint64_t PAGE_ALIGN = 64;
+
+    enum Encoding : uint32_t { RAW, DELTA_RLE, LZ4, DELTA_LZ4 };
+
+    struct Header {
+        char magic[8];
+        uint32_t version = VERSION;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t depth_bits = 8;
+        uint64_t frame_count = 0;
+        uint64_t index_offset = 0;
+        uint64_t calibration_count = 0;
+        uint64_t calibration_offset = 0;
+    };
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t encoding;
+        int64_t timestamp_ns;  // exposure, steady clock
+        uint32_t calibration_id;
+        uint32_t keyframe;  // frame the delta chain starts from
+    };
+
+    struct Calibration {
+        uint32_t id;
+        uint32_t reserved;
+        double homography[9];
+    };
+};
+
+static_assert(sizeof(RecordingFormat::Header) == 56);
+static_assert(sizeof(RecordingFormat::IndexEntry) == 32);
+static_assert(sizeof(RecordingFormat::Calibration) == 80);
+
+class RecordingWriter {
+   public:
+    enum Compression { NONE, DELTA, LZ4 };
+    static constexpr int KEYFRAME_INTERVAL = 30;
+
+   private:
+    std::ofstream m_file;
+    std::string m_path;
+    Compression m_compression;
+    RecordingFormat::Header m_header;
+    std::vector<RecordingFormat::IndexEntry> m_index;
+    std::vector<RecordingFormat::Calibration> m_calibrations;
+
+    cv::Mat m_previous;  // base of the next delta
+    uint32_t m_keyframe = 0;
+    std::vector<uint8_t> m_delta;
+    std::vector<uint8_t> m_encoded;
+    uint64_t m_raw_bytes = 0;
+    uint64_t m_written_bytes = 0;
+
+   public:
+    RecordingWriter(std::string path, Compression compression);
+    ~RecordingWriter();
+
+    RecordingWriter(const RecordingWriter &) = delete;
+    RecordingWriter &operator=(const RecordingWriter &) = delete;
+
+    // Best compression this build supports
+    static Compression bestCompression();
+
+    void addCalibration(uint32_t id, const cv::Mat &homography);
+    // plane is CV_8UC1 or CV_16UC1, every frame has the size of the first
+    void write(const cv::Mat &plane, int64_t timestamp_ns,
+               uint32_t calibration_id);
+    // Writes index and calibrations; the file is unreadable until then
+    void close();
+
+    uint64_t frameCount() const { return m_index.size(); }
+    uint64_t rawBytes() const { return m_raw_bytes; }
+    uint64_t writtenBytes() const { return m_written_bytes; }
+
+   private:
+    void pad();
+};
+
+// Maps a recording read-only. RAW frames are returned without copying.
+class RecordingReader {
+    int m_fd = -1;
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+
+    RecordingFormat::Header m_header;
+    const RecordingFormat::IndexEntry *m_index = nullptr;
+    const RecordingFormat::Calibration *m_calibrations = nullptr;
+
+    cv::Mat m_decoded;
+    int64_t m_decoded_index = -1;
+    std::vector<uint8_t> m_scratch;
+
+   public:
+    explicit RecordingReader(std::string path);
+    ~RecordingReader();
+
+    RecordingReader(const RecordingReader &) = delete;
+    RecordingReader &operator=(const RecordingReader &) = delete;
+
+    size_t frameCount() const { return m_header.frame_count; }
+    cv::Size size() const;
+    int type() const;
+    const RecordingFormat::IndexEntry &entry(size_t index) const;
+
+    // View into the mapping for RAW frames, otherwise a decoded buffer that
+    // stays valid until the next call
+    cv::Mat frame(size_t index);
+    // Identity if the id was never recorded
+    cv::Mat homography(uint32_t calibration_id) const;
+
+   private:
+    void decode(size_t index, cv::Mat &target);
+};
+
+// Writes frames on its own thread so capture never waits on the disk.
+// Frames that arrive faster than they are written are dropped, oldest first.
+class Recorder {
+    struct Item {
+        cv::Mat depth;
+        int64_t timestamp_ns;
+        uint32_t calibration_id;
+        cv::Mat homography;
+        DepthQuantizer quantizer;
+    };
+
+    Printer m_printer;
+    std::string m_path;
+    RecordingWriter m_writer;
+    BoundedQueue<Item> m_queue;
+    std::thread m_thread;
+    int64_t m_last_calibration = -1;
+
+   public:
+    Recorder(Printer printer, std::string path,
+             RecordingWriter::Compression compression, size_t capacity = 8);
+    ~Recorder();
+
+    // quantizer made depth if it is a float working image, such frames are
+    // recorded as its 16 bit image
+    void push(cv::Mat depth, FrameTimestamps::clock::time_point captured,
+              uint32_t calibration_id, cv::Mat homography,
+              const DepthQuantizer &quantizer);
+    void stop();
+
+   private:
+    void run();
+};
+
+#endif  // RECORDING_HPP
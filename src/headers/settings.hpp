@@ -3,6 +3,8 @@
 
 #include <getopt.h>
 
+#include <algorithm>
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
@@ -22,7 +24,7 @@ using namespace std;
 // TODO make secure
 // TODO probably need to make it unchangable from outside
 struct Config {
-    enum SOURCE_TYPE { IMAGE, SVO, STREAM };
+    enum SOURCE_TYPE { IMAGE, SVO, STREAM, REPLAY };
     enum TYPE { BOOL, STRING, INT, UCHAR };
     SOURCE_TYPE type = SOURCE_TYPE::STREAM;
     bool from_config = false;
@@ -39,11 +41,42 @@ struct Config {
 
     // Recognition
     bool recurse = false;
-    uchar z_limit = 10;
-    uchar min_distance = 0;
-    uchar medium_limit = 10;
+    // Working image steps, millimetres on float depth
+    int z_limit = 10;
+    int min_distance = 0;
+    int medium_limit = 10;
     int min_area = 1000;
     int max_objects = 10;
+    bool camera_space = false;  // segment raw depth, warp only the masks
+
+    // Pipeline
+    int queue_depth = 2;  // frames buffered between stages
+    int latency_period = 5;  // seconds between latency reports, 0 is off
+    int pool_workers = 0;    // shared thread pool size, 0 is one per core
+    bool pool_pin = false;   // pin pool workers to cores
+    int pool_first_core = 0;
+    int target_frame_time = 0;  // ms of processing per frame, 0 is off
+    bool replay_max_speed = false;  // ignore recorded pace on replay
+    bool record = false;  // write captured depth to output_location
+
+    // Depth input
+    bool metric_depth = false;  // quantize float depth, not the depth view
+    int depth_near = 300;       // mm, closer saturates
+    int depth_far = 20000;      // mm, farther is background
+    int depth_mapping = 0;      // 0 linear, 1 inverse depth
+    int depth_bits = 8;         // working image, 8, 16 or 32 (float)
+
+    // Output
+    string output_sink = "window";  // window, files or null
+    string key_source = "auto";     // window, terminal, none; auto follows
+                                    // the sink, the window sink needs window
+    string shm_name = "";  // publish results to /dev/shm/<name>, "" is off
+
+    // Calibration
+    int calibration_budget = 5000;  // ms to find the target, 0 is unlimited
+    int calibration_mode = 0;  // 0 homography, 1 Gray code remap table
+    int movement_every = 15;  // frames between camera movement checks that
+                              // trigger recalibration, 0 is off
 
     // ZED
     bool fill_mode = false;
@@ -78,14 +111,14 @@ struct Config {
          "toggle recursion [Dangerous]",
          TYPE::BOOL},
         {{"z_limit", required_argument, 0, 'Z'},
-         "define max difference between two points [0, 255]",
-         TYPE::UCHAR},
+         "define max difference between two points, in depth steps [int32]",
+         TYPE::INT},
         {{"min_distance", required_argument, 0, 'D'},
-         "define min distance [0, 255]",
-         TYPE::UCHAR},
+         "define min distance, in depth steps [int32]",
+         TYPE::INT},
         {{"medium_limit", required_argument, 0, 'M'},
-         "define medium value [0, 255]",
-         TYPE::UCHAR},
+         "define medium value, in depth steps [int32]",
+         TYPE::INT},
         {{"min_area", required_argument, 0, 'A'},
          "define minimum area [int32]",
          TYPE::INT},
@@ -110,6 +143,69 @@ struct Config {
         {{"camera_resolution", required_argument, 0, 'R'},
          "define camera resolution [0 8]",
          TYPE::INT},
+
+        {{"camera_space", no_argument, 0, 'S'},
+         "toggle segmentation in camera space (warp only found objects)",
+         TYPE::BOOL},
+        {{"queue_depth", required_argument, 0, 'Q'},
+         "define frames queued between pipeline stages [1 16]",
+         TYPE::INT},
+        {{"latency_period", required_argument, 0, 'L'},
+         "define seconds between latency reports, 0 to disable [int32]",
+         TYPE::INT},
+        {{"pool_workers", required_argument, 0, 'W'},
+         "define thread pool workers, 0 for one per core [0 256]",
+         TYPE::INT},
+        {{"pool_pin", no_argument, 0, 'P'},
+         "toggle pinning thread pool workers to cores",
+         TYPE::BOOL},
+        {{"pool_first_core", required_argument, 0, 'K'},
+         "define first core for pinned pool workers [int32]",
+         TYPE::INT},
+        {{"target_frame_time", required_argument, 0, 'G'},
+         "define processing budget per frame in ms, 0 to disable [int32]",
+         TYPE::INT},
+        {{"replay_max_speed", no_argument, 0, 'Y'},
+         "toggle replaying recordings as fast as they are consumed",
+         TYPE::BOOL},
+        {{"record", no_argument, 0, 'E'},
+         "toggle recording captured depth into a .dgtr file",
+         TYPE::BOOL},
+        {{"metric_depth", no_argument, 0, 'I'},
+         "toggle segmenting quantized metric depth instead of the depth view",
+         TYPE::BOOL},
+        {{"depth_near", required_argument, 0, 'J'},
+         "define nearest quantized depth in mm [int32]",
+         TYPE::INT},
+        {{"depth_far", required_argument, 0, 'F'},
+         "define farthest quantized depth in mm [int32]",
+         TYPE::INT},
+        {{"depth_mapping", required_argument, 0, 'V'},
+         "define depth quantization, 0 linear, 1 inverse depth [int32]",
+         TYPE::INT},
+        {{"depth_bits", required_argument, 0, 'b'},
+         "define quantized depth precision, 8, 16 or 32 (float) [int32]",
+         TYPE::INT},
+        {{"output_sink", required_argument, 0, 'o'},
+         "define where frames go: window, files or null [string]",
+         TYPE::STRING},
+        {{"key_source", required_argument, 0, 'k'},
+         "define key input: auto, window, terminal or none [string]",
+         TYPE::STRING},
+        {{"shm_name", required_argument, 0, 'p'},
+         "define shared memory name results are published to [string]",
+         TYPE::STRING},
+        {{"calibration_budget", required_argument, 0, 'c'},
+         "define ms calibration may search for its target, 0 is unlimited "
+         "[int32]",
+         TYPE::INT},
+        {{"calibration_mode", required_argument, 0, 'g'},
+         "define calibration, 0 homography for flat surfaces, 1 Gray code "
+         "per pixel mapping [int32]",
+         TYPE::INT},
+        {{"movement_every", required_argument, 0, 'm'},
+         "define frames between camera movement checks, 0 is off [int32]",
+         TYPE::INT},
     };
 
     // allows to set and/OR read parameter by name/flag
@@ -126,11 +222,16 @@ struct Config {
             return false;
         };
 
+        // flags come without a value from CLI and as "true"/"false" from json
+        auto toggle = [value]() -> bool {
+            return !(value && string(value) == "false");
+        };
+
         if (check(0)) {
-            if (set) save_logs = true;
+            if (set) save_logs = toggle();
             return save_logs ? "true" : "false";
         } else if (check(1)) {
-            if (set) measure_time = true;
+            if (set) measure_time = toggle();
             return measure_time ? "true" : "false";
         } else if (check(2)) {
             if (set) output_location = value;
@@ -142,7 +243,7 @@ struct Config {
             if (set) config_name = value;
             return config_name;
         } else if (check(5)) {
-            if (set) recurse = true;
+            if (set) recurse = toggle();
             return recurse ? "true" : "false";
         } else if (check(6)) {
             if (set) z_limit = atoi(value);
@@ -160,7 +261,7 @@ struct Config {
             if (set) max_objects = atoi(value);
             return to_string(max_objects);
         } else if (check(11)) {
-            if (set) fill_mode = true;
+            if (set) fill_mode = toggle();
             return fill_mode ? "true" : "false";
         } else if (check(12)) {
             if (set) threshold = atoi(value);
@@ -191,6 +292,122 @@ struct Config {
                         "Camera resolution parameter is out of bounds");
             }
             return to_string(camera_resolution);
+        } else if (check(17)) {
+            if (set) camera_space = toggle();
+            return camera_space ? "true" : "false";
+        } else if (check(18)) {
+            if (set) {
+                int depth = atoi(value);
+                if (depth <= 16 && depth >= 1) {
+                    queue_depth = depth;
+                } else
+                    throw runtime_error(
+                        "Queue depth parameter is out of bounds");
+            }
+            return to_string(queue_depth);
+        } else if (check(19)) {
+            if (set) latency_period = atoi(value);
+            return to_string(latency_period);
+        } else if (check(20)) {
+            if (set) {
+                int workers = atoi(value);
+                if (workers <= 256 && workers >= 0) {
+                    pool_workers = workers;
+                } else
+                    throw runtime_error(
+                        "Pool workers parameter is out of bounds");
+            }
+            return to_string(pool_workers);
+        } else if (check(21)) {
+            if (set) pool_pin = toggle();
+            return pool_pin ? "true" : "false";
+        } else if (check(22)) {
+            if (set) {
+                int core = atoi(value);
+                if (core >= 0) {
+                    pool_first_core = core;
+                } else
+                    throw runtime_error(
+                        "Pool first core parameter is out of bounds");
+            }
+            return to_string(pool_first_core);
+        } else if (check(23)) {
+            if (set) target_frame_time = atoi(value);
+            return to_string(target_frame_time);
+        } else if (check(24)) {
+            if (set) replay_max_speed = toggle();
+            return replay_max_speed ? "true" : "false";
+        } else if (check(25)) {
+            if (set) record = toggle();
+            return record ? "true" : "false";
+        } else if (check(26)) {
+            if (set) metric_depth = toggle();
+            return metric_depth ? "true" : "false";
+        } else if (check(27)) {
+            if (set) depth_near = atoi(value);
+            return to_string(depth_near);
+        } else if (check(28)) {
+            if (set) depth_far = atoi(value);
+            return to_string(depth_far);
+        } else if (check(29)) {
+            if (set) {
+                int mapping = atoi(value);
+                if (mapping == 0 || mapping == 1) {
+                    depth_mapping = mapping;
+                } else
+                    throw runtime_error(
+                        "Depth mapping parameter is out of bounds");
+            }
+            return to_string(depth_mapping);
+        } else if (check(30)) {
+            if (set) {
+                int bits = atoi(value);
+                if (bits == 8 || bits == 16 || bits == 32) {
+                    depth_bits = bits;
+                } else
+                    throw runtime_error(
+                        "Depth bits parameter is out of bounds");
+            }
+            return to_string(depth_bits);
+        } else if (check(31)) {
+            if (set) output_sink = value;
+            return output_sink;
+        } else if (check(32)) {
+            if (set) key_source = value;
+            return key_source;
+        } else if (check(33)) {
+            if (set) shm_name = value;
+            return shm_name;
+        } else if (check(34)) {
+            if (set) {
+                int budget = atoi(value);
+                if (budget >= 0) {
+                    calibration_budget = budget;
+                } else
+                    throw runtime_error(
+                        "Calibration budget parameter is out of bounds");
+            }
+            return to_string(calibration_budget);
+        } else if (check(35)) {
+            if (set) {
+                int mode = atoi(value);
+                if (mode == 0 || mode == 1) {
+                    calibration_mode = mode;
+                } else
+                    throw runtime_error(
+                        "Calibration mode parameter is out of bounds");
+            }
+            return to_string(calibration_mode);
+        } else if (check(36)) {
+            if (set) {
+                int every = atoi(value);
+                if (every >= 0) {
+                    movement_every = every;
+                } else
+                    throw runtime_error(
+                        "Movement check parameter is out of bounds");
+            }
+            return to_string(movement_every);
         } else
             throw runtime_error("Wrong parameter");
     }
@@ -233,6 +450,14 @@ struct ErosionDilation {
     uchar size = 3;
 };
 
+// One step of the adaptive quality ladder
+struct QualityLevel {
+    float scale = 1;                // processing resolution factor
+    int erodil_passes = -1;         // -1 runs every configured pass
+    int segment_every = 1;          // reuse objects in between
+    bool simple_templates = false;  // solid colour instead of gradient
+};
+
 // struct HoughLinesPsets {
 //     int rho = 5;
 //     int theta_denom = 140;
@@ -241,6 +466,8 @@ struct ErosionDilation {
 //     int max_line_gap = 10;
 // };
 
+// Deprecated: the calibration quad is fitted to the hull, nothing uses the
+// HoughLinesP keys any more. They are still parsed so old configs load.
 struct HoughLinesPsets {
     int rho = 10;
     int theta_denom = 100;
@@ -259,10 +486,16 @@ class Settings {
     Config config;
     vector<ErosionDilation> erodil;
     HoughLinesPsets hough_params;
+    vector<QualityLevel> quality_ladder;  // best quality first
 
     Settings() {
         erodil.push_back({ErosionDilation::Type::Erosion, 3, 3});
         erodil.push_back({ErosionDilation::Type::Dilation, 3, 3});
+
+        quality_ladder.push_back({1.0, -1, 1, false});
+        quality_ladder.push_back({0.75, -1, 1, false});
+        quality_ladder.push_back({0.5, 2, 1, true});
+        quality_ladder.push_back({0.5, 2, 2, true});
     }
 
     Printer::ERROR Init(int argc, char **argv) {
@@ -282,6 +515,13 @@ class Settings {
 
         if (filename.at(0) == '-') return Printer::ERROR::SUCCESS;
 
+        if (std::filesystem::is_directory(filename)) {
+            std::cout << "Replaying recording..." << std::endl;
+            config.type = Config::SOURCE_TYPE::REPLAY;
+            config.file_path = filename;
+            return Printer::ERROR::SUCCESS;
+        }
+
         size_t dot_pos = filename.find_last_of('.');
 
         if (dot_pos != std::string::npos) {
@@ -291,6 +531,8 @@ class Settings {
 
             if (extension == "svo")
                 config.type = Config::SOURCE_TYPE::SVO;
+            else if (extension == "dgtr")
+                config.type = Config::SOURCE_TYPE::REPLAY;
             else
                 config.type = Config::SOURCE_TYPE::IMAGE;
         } else {
@@ -327,8 +569,9 @@ class Settings {
 
             // TODO Make this string autocreated
             c = getopt_long(m_argc, m_argv,
-                            "hltrfO:C:Z:D:M:A:B:T:X:U:R:", m_long_options,
-                            &option_index);
+                            "hltrfSPYEIO:C:Z:D:M:A:B:T:X:U:R:Q:L:W:K:G:J:F:"
+                            "V:b:o:k:p:c:g:m:",
+                            m_long_options, &option_index);
 
             if (c == -1) break;
 
@@ -445,7 +688,7 @@ class Settings {
                 std::cout << std::endl;
 
                 try {
-                    // Parse HoughLinesP
+                    // Parse HoughLinesP, deprecated and unused
                     hough_params.rho =
                         configuration["HoughLinesP"]["rho"].get<int>();
                     hough_params.theta_denom =
@@ -492,6 +735,31 @@ class Settings {
                 }
 
                 std::cout << "Erodil size: " << erodil.size() << std::endl;
+
+                // Parse quality ladder
+                if (configuration.contains("quality_ladder")) {
+                    quality_ladder.clear();
+                    for (const auto &entry : configuration["quality_ladder"]) {
+                        try {
+                            QualityLevel level;
+                            level.scale = entry.value("scale", 1.0f);
+                            level.erodil_passes =
+                                entry.value("erodil_passes", -1);
+                            level.segment_every =
+                                std::max(1, entry.value("segment_every", 1));
+                            level.simple_templates =
+                                entry.value("simple_templates", false);
+                            if (level.scale <= 0 || level.scale > 1)
+                                throw runtime_error("Scale out of (0, 1]");
+                            quality_ladder.push_back(level);
+                        } catch (const std::exception &e) {
+                            std::cerr << e.what() << '\n';
+                        }
+                    }
+                }
+
+                std::cout << "Quality levels: " << quality_ladder.size()
+                          << std::endl;
                 found_config = true;
             }
 
@@ -0,0 +1,49 @@
+#ifndef SHM_PUBLISHER_HPP
+#define SHM_PUBLISHER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "latency.hpp"
+#include "object_recognition.hpp"
+#include "opencv2/opencv.hpp"
+#include "shm_ring.hpp"
+
+// Publishes projector frames and their objects to local readers through a
+// shared memory ring, see ShmRing for the layout and ShmReader for the read
+// side. Nothing is serialized and nothing touches the disk; publish() is
+// one copy into the slot and never waits for readers.
+class ShmPublisher {
+    std::string m_name;
+    int m_fd = -1;
+    uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    ShmRing::Header *m_header = nullptr;
+    uint64_t m_published = 0;
+
+   public:
+    // Frames up to max_size with 8 bit channels, others are dropped
+    ShmPublisher(std::string name, cv::Size max_size, int channels,
+                 uint32_t max_objects, uint32_t slots = 4);
+    ~ShmPublisher();
+
+    ShmPublisher(const ShmPublisher &) = delete;
+    ShmPublisher &operator=(const ShmPublisher &) = delete;
+
+    // Whether publish() takes the image, empty ones always fit
+    bool fits(const cv::Mat &image) const;
+
+    // Empty images publish only the objects
+    bool publish(uint64_t frame_id, FrameTimestamps::clock::time_point captured,
+                 const cv::Mat &image,
+                 const std::vector<ImageProcessor::MatWithInfo> &objects);
+
+    uint64_t published() const { return m_published; }
+    const std::string &name() const { return m_name; }
+
+   private:
+    uint8_t *slot(uint64_t index);
+};
+
+#endif  // SHM_PUBLISHER_HPP
@@ -0,0 +1,205 @@
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Shared memory layout written by ShmPublisher, /dev/shm/<name>:
+//
+//   Header
+//   Slot[slot_count]    SlotHeader, ObjectInfo[max_objects], pixels
+//
+// Every slot is a seqlock. Its sequence is odd while the publisher writes
+// it, a reader keeps what it read only if the sequence is even and did not
+// change meanwhile. Header::published counts frames, frame n lives in slot
+// (n - 1) % slot_count, so a reader has slot_count - 1 frames of time.
+//
+// Frames that outgrow the ring get a new one under the same name. The old
+// one is marked retired and left to its readers, which reopen the name.
+//
+// Plain C++ and POSIX only, readers do not need OpenCV.
+struct ShmRing {
+    static constexpr char MAGIC[8] = {'D', 'G', 'T', 'S', 'H', 'M', '0', '1'};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t ALIGN = 64;
+
+    struct ObjectInfo {
+        uint32_t id;    // 1 based, in segmentation order
+        uint32_t area;  // pixels of the working image
+        int32_t x, y, width, height;  // bounding box in the frame
+        float centroid_x, centroid_y;
+        float mean_depth;  // working image units
+        uint32_t reserved;
+    };
+
+    struct alignas(ALIGN) Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t max_objects;
+        uint32_t max_width;
+        uint32_t max_height;
+        uint32_t channels;  // 8 bit channels per pixel, BGR
+        uint64_t slot_size;
+        std::atomic<uint64_t> published;
+        std::atomic<uint32_t> retired;  // no more frames come here
+    };
+
+    struct alignas(ALIGN) SlotHeader {
+        std::atomic<uint64_t> sequence;
+        uint64_t published;     // which frame of the stream this is
+        uint64_t frame_id;      // pipeline frame id
+        int64_t captured_ns;    // exposure, steady clock
+        int64_t published_ns;   // steady clock
+        uint32_t width;         // 0 when nothing is rendered in this mode
+        uint32_t height;
+        uint32_t object_count;
+        uint32_t reserved;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "seqlock needs lock free 64 bit atomics");
+
+    static size_t align(size_t size) {
+        return (size + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+    static size_t objectsOffset() { return sizeof(SlotHeader); }
+    static size_t pixelsOffset(uint32_t max_objects) {
+        return align(objectsOffset() + max_objects * sizeof(ObjectInfo));
+    }
+    static size_t slotSize(uint32_t max_objects, uint32_t width,
+                           uint32_t height, uint32_t channels) {
+        return align(pixelsOffset(max_objects) +
+                     size_t(width) * height * channels);
+    }
+    static size_t totalSize(uint32_t slot_count, size_t slot_size) {
+        return sizeof(Header) + slot_count * slot_size;
+    }
+};
+
+// Read side of the ring, maps it read only and never writes
+class ShmReader {
+   public:
+    // Points into shared memory, valid only until the slot is reused
+    struct View {
+        const ShmRing::SlotHeader *slot;
+        const ShmRing::ObjectInfo *objects;
+        const uint8_t *pixels;  // width * channels bytes per row
+        uint32_t channels;
+    };
+
+   private:
+    int m_fd = -1;
+    uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    const ShmRing::Header *m_header = nullptr;
+
+    uint64_t m_last = 0;     // last frame read
+    uint64_t m_torn = 0;     // reads lost to the publisher
+    uint64_t m_skipped = 0;  // frames published but never read
+
+   public:
+    explicit ShmReader(std::string name) {
+        m_fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+        if (m_fd < 0)
+            throw std::runtime_error("Cannot open shared memory " + name);
+
+        struct stat info;
+        if (fstat(m_fd, &info) != 0 ||
+            size_t(info.st_size) < sizeof(ShmRing::Header)) {
+            close();
+            throw std::runtime_error("Shared memory " + name + " is too small");
+        }
+        m_size = info.st_size;
+
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED) {
+            close();
+            throw std::runtime_error("Cannot map shared memory " + name);
+        }
+        m_data = static_cast<uint8_t *>(data);
+        m_header = reinterpret_cast<const ShmRing::Header *>(m_data);
+
+        if (std::memcmp(m_header->magic, ShmRing::MAGIC, 8) != 0 ||
+            m_header->version != ShmRing::VERSION ||
+            m_size < ShmRing::totalSize(m_header->slot_count,
+                                        m_header->slot_size)) {
+            close();
+            throw std::runtime_error("Shared memory " + name +
+                                     " is not a result ring");
+        }
+    }
+
+    ~ShmReader() { close(); }
+
+    ShmReader(const ShmReader &) = delete;
+    ShmReader &operator=(const ShmReader &) = delete;
+
+    const ShmRing::Header &header() const { return *m_header; }
+
+    uint64_t published() const {
+        return m_header->published.load(std::memory_order_acquire);
+    }
+    // Once set, newer frames are in a ring opened anew under the name
+    bool retired() const {
+        return m_header->retired.load(std::memory_order_acquire) != 0;
+    }
+    uint64_t torn() const { return m_torn; }
+    uint64_t skipped() const { return m_skipped; }
+
+    // Hands the newest unread frame to use(const View &) in place. Returns
+    // true if there was one and it stayed intact until use returned;
+    // otherwise whatever use did with it has to be thrown away.
+    template <typename Use>
+    bool readLatest(Use &&use) {
+        uint64_t newest = published();
+        if (newest == 0 || newest == m_last) return false;
+
+        const uint8_t *base =
+            m_data + sizeof(ShmRing::Header) +
+            ((newest - 1) % m_header->slot_count) * m_header->slot_size;
+        auto slot = reinterpret_cast<const ShmRing::SlotHeader *>(base);
+
+        uint64_t before = slot->sequence.load(std::memory_order_acquire);
+        if ((before & 1) || slot->published != newest) {
+            m_torn++;
+            return false;
+        }
+
+        use(View{slot,
+                 reinterpret_cast<const ShmRing::ObjectInfo *>(
+                     base + ShmRing::objectsOffset()),
+                 base + ShmRing::pixelsOffset(m_header->max_objects),
+                 m_header->channels});
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) != before) {
+            m_torn++;
+            return false;
+        }
+
+        if (m_last != 0) m_skipped += newest - m_last - 1;
+        m_last = newest;
+        return true;
+    }
+
+   private:
+    void close() {
+        if (m_data) munmap(m_data, m_size);
+        if (m_fd >= 0) ::close(m_fd);
+        m_data = nullptr;
+        m_fd = -1;
+    }
+};
+
+#endif  // SHM_RING_HPP
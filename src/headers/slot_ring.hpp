@@ -0,0 +1,84 @@
+#ifndef SLOT_RING_HPP
+#define SLOT_RING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Fixed set of reusable buffers handed out as leases.
+//
+// acquire() takes a free slot and returns it as a shared_ptr; the slot goes
+// back to the ring once the last copy of the lease is dropped, on whatever
+// thread that happens. Slots are created once and recycled, the most
+// recently released first while its memory is still warm. Leases may
+// outlive the ring, the slots live as long as either does.
+template <typename T>
+class SlotRing {
+    struct State {
+        std::mutex mutex;
+        std::condition_variable released;
+        std::vector<std::unique_ptr<T>> slots;
+        std::vector<size_t> free;
+    };
+
+    std::shared_ptr<State> m_state = std::make_shared<State>();
+    std::atomic<uint64_t> m_starved{0};  // acquire() calls that found none
+
+   public:
+    using Lease = std::shared_ptr<T>;
+
+    explicit SlotRing(size_t count = 0) { reserve(count); }
+
+    SlotRing(const SlotRing &) = delete;
+    SlotRing &operator=(const SlotRing &) = delete;
+
+    // Grows the ring to at least count slots, never shrinks it
+    void reserve(size_t count) {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        while (m_state->slots.size() < count) {
+            m_state->free.push_back(m_state->slots.size());
+            m_state->slots.push_back(std::make_unique<T>());
+        }
+        m_state->released.notify_all();
+    }
+
+    // Waits up to timeout for a free slot, an empty lease if none came back
+    Lease acquire(std::chrono::milliseconds timeout) {
+        std::shared_ptr<State> state = m_state;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (!state->released.wait_for(lock, timeout,
+                                      [&] { return !state->free.empty(); })) {
+            m_starved++;
+            return nullptr;
+        }
+
+        size_t index = state->free.back();
+        state->free.pop_back();
+        return Lease(state->slots.at(index).get(), [state, index](T *) {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->free.push_back(index);
+            }
+            state->released.notify_one();
+        });
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        return m_state->slots.size();
+    }
+
+    size_t available() const {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        return m_state->free.size();
+    }
+
+    uint64_t starved() const { return m_starved; }
+};
+
+#endif  // SLOT_RING_HPP
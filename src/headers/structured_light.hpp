@@ -0,0 +1,71 @@
+#ifndef STRUCTURED_LIGHT_HPP
+#define STRUCTURED_LIGHT_HPP
+
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+// Dense camera -> projector mapping for cv::remap, in the fixed point form
+// remap is fastest with. Applied to a camera image it gives the projector
+// image, like warpPerspective with the homography does for flat surfaces.
+struct RemapTable {
+    cv::Mat map;       // CV_16SC2, integer camera coordinates
+    cv::Mat fraction;  // CV_16UC1, interpolation table index
+
+    bool empty() const { return map.empty(); }
+    cv::Size size() const { return map.size(); }
+
+    void apply(const cv::Mat &camera, cv::Mat &projector,
+               int interpolation = cv::INTER_LINEAR) const {
+        cv::remap(camera, projector, map, fraction, interpolation,
+                  cv::BORDER_CONSTANT);
+    }
+};
+
+// Binary reflected Gray code patterns over the projector image and their
+// decoding from camera captures, for surfaces that are not flat.
+//
+// Projection order: all white, all black, then per bit of x and then of y,
+// most significant first, the stripe pattern followed by its inverse.
+// A camera pixel's bit is set where the pattern is brighter than its
+// inverse, which needs no global threshold and tolerates uneven surfaces.
+// Decoding works on whole images at a time.
+class GrayCodePattern {
+   public:
+    struct Parameters {
+        int min_contrast = 20;     // white - black, else the pixel is unlit
+        int min_bit_contrast = 3;  // |pattern - inverse| of every bit
+        int cell = 4;  // projector pixels per cell of the inverted table
+    };
+
+   private:
+    cv::Size m_projector;
+    Parameters m_parameters;
+    int m_bits_x;
+    int m_bits_y;
+
+   public:
+    GrayCodePattern(cv::Size projector);
+    GrayCodePattern(cv::Size projector, Parameters parameters);
+
+    int count() const { return 2 + 2 * (m_bits_x + m_bits_y); }
+    cv::Size projector() const { return m_projector; }
+
+    // CV_8UC1 projector image of the index-th pattern
+    cv::Mat pattern(int index) const;
+
+    // Projector coordinates every camera pixel sees, CV_32FC2 stripe
+    // centres, (-1, -1) where nothing could be decoded. Captures are
+    // CV_8UC1 in projection order.
+    cv::Mat decode(const std::vector<cv::Mat> &captures) const;
+
+    // Inverts decode() into the table the hot path remaps with: for every
+    // projector pixel the camera pixel that sees it. Averaged over cells,
+    // holes filled from their neighbours, interpolated back to full size.
+    RemapTable remapTable(const cv::Mat &decoded) const;
+
+   private:
+    static int bitsFor(int size);
+};
+
+#endif  // STRUCTURED_LIGHT_HPP
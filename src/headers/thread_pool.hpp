@@ -0,0 +1,89 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "opencv2/core.hpp"
+#include "utils.hpp"
+
+// One work-stealing pool for every data-parallel job in the process.
+//
+// Each worker owns a deque per priority. Workers take their own newest task
+// first and steal the oldest task of the others when idle; higher priorities
+// are always drained first. OpenCV's parallel_for_ can be routed into the
+// same workers (useOpenCV), so library and own tasks never oversubscribe.
+class ThreadPool {
+   public:
+    enum Priority { HIGH, NORMAL, LOW, PRIORITY_COUNT };
+
+    struct Stats {
+        int workers = 0;
+        long submitted = 0;
+        long executed = 0;
+        long stolen = 0;
+        int queued = 0;
+    };
+
+   private:
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::mutex mutex;
+        std::array<std::deque<Task>, PRIORITY_COUNT> queues;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+    std::atomic<int> m_queued{0};
+    std::atomic<bool> m_stop{false};
+    std::atomic<unsigned> m_next_worker{0};
+
+    std::atomic<long> m_submitted{0};
+    std::atomic<long> m_executed{0};
+    std::atomic<long> m_stolen{0};
+
+   public:
+    // 0 workers means one per hardware thread; cores are pinned starting
+    // from first_core when pin_threads is set
+    ThreadPool(int workers = 0, bool pin_threads = false, int first_core = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(Task task, Priority priority = NORMAL);
+
+    // Runs body(begin, end) over [0, count) and returns when all of it is
+    // done. The calling thread works along, so nesting cannot deadlock.
+    void parallelFor(int count, const std::function<void(int, int)> &body,
+                     Priority priority = NORMAL, int grain = 1);
+
+    int workers() const { return m_workers.size(); }
+
+    // Index of the calling worker, -1 outside of the pool
+    static int workerIndex();
+
+    Stats stats() const;
+    void printStats(Printer &printer) const;
+
+    // Routes cv::parallel_for_ into this pool (OpenCV >= 4.5.2), otherwise
+    // limits OpenCV's own threads to the pool size
+    static void useOpenCV(std::shared_ptr<ThreadPool> pool);
+
+   private:
+    void run(int index);
+    bool take(int index, Task &task);
+};
+
+#endif  // THREAD_POOL_HPP
@@ -0,0 +1,54 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Single-producer/single-consumer triple buffer.
+//
+// The producer fills writeBuffer() and calls publish(); the consumer calls
+// update() and reads readBuffer(). Neither side ever blocks or copies: the
+// three slots are only swapped by index. The consumer always sees the latest
+// complete value, intermediate ones are silently overwritten.
+template <typename T>
+class TripleBuffer {
+    static constexpr uint8_t INDEX_MASK = 0b011;
+    static constexpr uint8_t FRESH_BIT = 0b100;
+
+    std::array<T, 3> m_buffers;
+
+    // Slot that is currently handed over, plus "not read yet" flag
+    std::atomic<uint8_t> m_shared{1};
+    uint8_t m_write = 0;  // owned by the producer
+    uint8_t m_read = 2;   // owned by the consumer
+
+   public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    // Producer side
+    T &writeBuffer() { return m_buffers[m_write]; }
+
+    void publish() {
+        uint8_t previous =
+            m_shared.exchange(m_write | FRESH_BIT, std::memory_order_acq_rel);
+        m_write = previous & INDEX_MASK;
+    }
+
+    // Consumer side; returns true if readBuffer() changed
+    bool update() {
+        if (!(m_shared.load(std::memory_order_relaxed) & FRESH_BIT))
+            return false;
+
+        uint8_t previous =
+            m_shared.exchange(m_read, std::memory_order_acq_rel);
+        m_read = previous & INDEX_MASK;
+        return true;
+    }
+
+    const T &readBuffer() const { return m_buffers[m_read]; }
+};
+
+#endif  // TRIPLE_BUFFER_HPP
@@ -5,6 +5,7 @@
 #include <ctime>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <opencv2/highgui.hpp>
@@ -36,6 +37,13 @@ struct InteractiveState {
     std::vector<std::pair<std::string, int>> scales{{"brightness", 10},
                                                     {"alpha", 1}};
 
+    // Key input with cv::waitKey semantics; replaced by the owner of the
+    // actual key source so nothing here depends on a window
+    std::function<int(int)> read_key = [](int timeout) {
+        return cv::waitKey(timeout);
+    };
+    int readKey(int timeout) { return read_key(timeout); }
+
     void printHelp() {
         std::cout << "    Press 'q' to exit" << std::endl;
         std::cout << "    Press 'p' or ' ' to pasue" << std::endl;
@@ -126,7 +134,7 @@ struct InteractiveState {
         if (key == 'r') restart_cam = true;
 
         while (pause && !next) {
-            key = cv::waitKey(0);
+            key = readKey(0);
             if (key == 'p') pause = !pause;
             if (key == ' ' || key == 'q') next = true;
         }
@@ -145,6 +153,11 @@ class Printer {
         ERROR_TURNED_OFF,
         ARGS_FAILURE,
         FLAGS_FAILURE,
+        INFO_LATENCY,
+        INFO_QUALITY,
+        INFO_RECORDING,
+        INFO_RETRIEVAL,
+        INFO_CALIBRATION,
     };
 
     enum DEBUG_LVL { PRODUCTION, BRIEF, VERBOSE };
@@ -169,6 +182,22 @@ class Printer {
         {false, {"[WARN] Function is off"}},
         {true, {"[ERROR] Wrong Arguments\n[ERROR] For help use: -h", ""}},
         {false, {"[ERROR] Wrong Flags\n[ERROR] For help use: -h\n", ""}},
+        {true,
+         {"[INFO] latency ", " p50 = ", " p95 = ", " p99 = ", " max = ",
+          " us"}},
+        {true,
+         {"[INFO] quality ", " to level ", " (frame ", " ms / budget ",
+          " ms): scale ", "%, erodil passes ", ", segment every ",
+          ", simple templates ", ""}},
+        {true,
+         {"[INFO] recording ", " frames = ", " dropped = ", " size = ",
+          "% of raw"}},
+        {true,
+         {"[INFO] retrieval ", " frames = ", " fetched = ", " MB, skipped = ",
+          " MB"}},
+        {true,
+         {"[INFO] calibration ", " frames = ", " time = ", " ms, area = ",
+          ""}},
     };
 
     struct message {
@@ -0,0 +1,248 @@
+#include "../headers/calibration.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <vector>
+
+CalibrationDetector::CalibrationDetector(Parameters parameters)
+    : m_parameters(parameters) {
+    reset();
+}
+
+void CalibrationDetector::reset() {
+    m_started = clock::now();
+    m_frames = 0;
+    m_stable = 0;
+    m_detection = Detection();
+}
+
+std::chrono::milliseconds CalibrationDetector::elapsed() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        clock::now() - m_started);
+}
+
+CalibrationDetector::Status CalibrationDetector::feed(const cv::Mat &gray) {
+    if (m_parameters.budget.count() > 0 && elapsed() > m_parameters.budget)
+        return TIMED_OUT;
+    m_frames++;
+
+    Detection current;
+    if (!detect(gray, current)) {
+        m_stable = 0;
+        return SEARCHING;
+    }
+
+    m_stable = m_stable > 0 && agrees(current, m_detection) ? m_stable + 1 : 1;
+    m_detection = current;
+    return m_stable >= m_parameters.stable_frames ? CONVERGED : SEARCHING;
+}
+
+bool CalibrationDetector::detect(const cv::Mat &gray, Detection &detection) {
+    double min, max;
+    cv::minMaxLoc(gray, &min, &max);
+    if (max - min < m_parameters.min_contrast) return false;
+
+    // The lit area is the brightest part of the view
+    double mean = cv::mean(gray)[0];
+    detection.threshold = int(max - (max - mean) / 2);
+    cv::threshold(gray, m_binary, detection.threshold, 255,
+                  cv::THRESH_BINARY);
+
+    int count = cv::connectedComponentsWithStats(m_binary, m_labels, m_stats,
+                                                 m_centroids, 8, CV_32S);
+    int best = 0;
+    for (int label = 1; label < count; label++) {
+        int area = m_stats.at<int>(label, cv::CC_STAT_AREA);
+        if (area > detection.area) {
+            detection.area = area;
+            best = label;
+        }
+    }
+    if (best == 0 || detection.area < m_parameters.min_area) return false;
+
+    detection.bbox = cv::Rect(m_stats.at<int>(best, cv::CC_STAT_LEFT),
+                              m_stats.at<int>(best, cv::CC_STAT_TOP),
+                              m_stats.at<int>(best, cv::CC_STAT_WIDTH),
+                              m_stats.at<int>(best, cv::CC_STAT_HEIGHT));
+    cv::compare(m_labels, best, detection.mask, cv::CMP_EQ);
+    return true;
+}
+
+bool CalibrationDetector::agrees(const Detection &current,
+                                 const Detection &previous) const {
+    double tolerance = m_parameters.tolerance;
+    int dx = std::max(1, int(previous.bbox.width * tolerance));
+    int dy = std::max(1, int(previous.bbox.height * tolerance));
+
+    return std::abs(current.bbox.x - previous.bbox.x) <= dx &&
+           std::abs(current.bbox.y - previous.bbox.y) <= dy &&
+           std::abs(current.bbox.br().x - previous.bbox.br().x) <= dx &&
+           std::abs(current.bbox.br().y - previous.bbox.br().y) <= dy &&
+           std::abs(current.area - previous.area) <= previous.area * tolerance;
+}
+
+namespace {
+
+double distanceToSegment(cv::Point2f point, cv::Point2f a, cv::Point2f b) {
+    cv::Point2f side = b - a;
+    double length2 = side.dot(side);
+    double t = length2 > 0 ? (point - a).dot(side) / length2 : 0;
+    t = std::clamp(t, 0.0, 1.0);
+    cv::Point2f closest = a + side * float(t);
+    return cv::norm(point - closest);
+}
+
+// Lines as (vx, vy, x0, y0) from cv::fitLine
+bool intersect(const cv::Vec4f &first, const cv::Vec4f &second,
+               cv::Point2f &point) {
+    float det = first[0] * second[1] - first[1] * second[0];
+    if (std::abs(det) < 1e-6f) return false;  // parallel
+    float dx = second[2] - first[2];
+    float dy = second[3] - first[3];
+    float t = (dx * second[1] - dy * second[0]) / det;
+    point = cv::Point2f(first[2] + t * first[0], first[3] + t * first[1]);
+    return true;
+}
+
+// Clockwise in image coordinates, starting with the top-left one
+std::array<cv::Point2f, 4> orderCorners(const std::vector<cv::Point> &quad) {
+    cv::Point2f center(0, 0);
+    for (const auto &point : quad) center += cv::Point2f(point) * 0.25f;
+
+    std::array<cv::Point2f, 4> corners;
+    for (int i = 0; i < 4; i++) corners.at(i) = quad.at(i);
+    std::sort(corners.begin(), corners.end(),
+              [center](cv::Point2f a, cv::Point2f b) {
+                  return std::atan2(a.y - center.y, a.x - center.x) <
+                         std::atan2(b.y - center.y, b.x - center.x);
+              });
+
+    int first = 0;
+    for (int i = 1; i < 4; i++)
+        if (corners.at(i).x + corners.at(i).y <
+            corners.at(first).x + corners.at(first).y)
+            first = i;
+    std::rotate(corners.begin(), corners.begin() + first, corners.end());
+    return corners;
+}
+
+}  // namespace
+
+QuadFit fitQuad(const cv::Mat &mask) {
+    QuadFit fit;
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+    if (contours.empty()) return fit;
+    const auto &contour = *std::max_element(
+        contours.begin(), contours.end(), [](const auto &a, const auto &b) {
+            return cv::contourArea(a) < cv::contourArea(b);
+        });
+
+    // Simplify the hull just enough to leave four vertices
+    std::vector<cv::Point> hull;
+    cv::convexHull(contour, hull);
+    double perimeter = cv::arcLength(hull, true);
+    std::vector<cv::Point> quad;
+    for (double epsilon = 0.01; epsilon <= 0.1 && quad.size() != 4;
+         epsilon += 0.005)
+        cv::approxPolyDP(hull, quad, epsilon * perimeter, true);
+    if (quad.size() != 4) return fit;
+    std::array<cv::Point2f, 4> corners = orderCorners(quad);
+
+    // Contour points along each side, away from the rounded corners
+    std::array<std::vector<cv::Point2f>, 4> sides;
+    for (const auto &point : contour) {
+        cv::Point2f p(point);
+        int side = 0;
+        double best = std::numeric_limits<double>::max();
+        for (int i = 0; i < 4; i++) {
+            double distance =
+                distanceToSegment(p, corners.at(i), corners.at((i + 1) % 4));
+            if (distance < best) {
+                best = distance;
+                side = i;
+            }
+        }
+
+        cv::Point2f a = corners.at(side);
+        cv::Point2f b = corners.at((side + 1) % 4);
+        double margin = 0.1 * cv::norm(b - a);
+        if (cv::norm(p - a) > margin && cv::norm(p - b) > margin)
+            sides.at(side).push_back(p);
+    }
+
+    std::array<cv::Vec4f, 4> lines;
+    for (int i = 0; i < 4; i++) {
+        if (sides.at(i).size() < 2) return fit;
+        cv::fitLine(sides.at(i), lines.at(i), cv::DIST_HUBER, 0, 0.01, 0.01);
+    }
+
+    // Corner i sits between side i - 1 and side i
+    for (int i = 0; i < 4; i++)
+        if (!intersect(lines.at((i + 3) % 4), lines.at(i), corners.at(i)))
+            return fit;
+
+    double squares = 0;
+    size_t count = 0;
+    for (int i = 0; i < 4; i++) {
+        const cv::Vec4f &line = lines.at(i);
+        for (const auto &p : sides.at(i)) {
+            double distance =
+                (p.x - line[2]) * line[1] - (p.y - line[3]) * line[0];
+            squares += distance * distance;
+        }
+        count += sides.at(i).size();
+    }
+    fit.residual = std::sqrt(squares / count);
+
+    // How well the quad covers the mask, and nothing else
+    std::vector<cv::Point> polygon;
+    for (const auto &corner : corners) polygon.push_back(corner);
+    cv::Mat area = cv::Mat::zeros(mask.size(), CV_8U);
+    cv::fillConvexPoly(area, polygon, cv::Scalar(255));
+    cv::Mat lit = mask > 0;
+    double overlap = cv::countNonZero(area & lit);
+    double total = cv::countNonZero(area | lit);
+
+    fit.corners = corners;
+    fit.score = total > 0 ? overlap / total : 0;
+    fit.found = true;
+    return fit;
+}
+
+void CalibrationCache::save(std::string path) const {
+    // Written aside and renamed, a crash never leaves half a cache
+    std::string partial = path + ".part.yml.gz";
+    {
+        cv::FileStorage storage(
+            partial, cv::FileStorage::WRITE | cv::FileStorage::BASE64);
+        if (!storage.isOpened())
+            throw std::runtime_error("Cannot write calibration " + partial);
+        storage << "version" << VERSION;
+        storage << "serial" << serial;
+        storage << "resolution" << resolution;
+        storage << "homography" << homography;
+        storage << "roi" << roi;
+        storage << "reference" << reference;
+    }
+    std::filesystem::rename(partial, path);
+}
+
+bool CalibrationCache::load(std::string path) {
+    if (!std::filesystem::exists(path)) return false;
+    cv::FileStorage storage(path, cv::FileStorage::READ);
+    if (!storage.isOpened() || int(storage["version"]) != VERSION)
+        return false;
+
+    storage["serial"] >> serial;
+    storage["resolution"] >> resolution;
+    storage["homography"] >> homography;
+    storage["roi"] >> roi;
+    storage["reference"] >> reference;
+    return !homography.empty() && !reference.empty() &&
+           roi.size() == resolution;
+}
@@ -0,0 +1,101 @@
+#include "../headers/depth_quantizer.hpp"
+
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+namespace {
+
+// Branch-free body so the row loop vectorizes; NaN fails every comparison
+template <typename T, bool INVERSE>
+void quantizeRows(const cv::Mat &depth, cv::Mat &out,
+                  DepthQuantizer::Parameters parameters, int begin, int end) {
+    constexpr bool METRIC = std::is_floating_point_v<T>;
+    const float near = parameters.near;
+    const float far = parameters.far;
+    const float origin = INVERSE ? 1.0f / far : far;
+    // Integer depth lands in [1, max], rounded; metric depth is not scaled
+    const float top = METRIC ? 0 : float(std::numeric_limits<T>::max());
+    const float scale =
+        METRIC ? 1
+               : (INVERSE ? (top - 1) / (1.0f / near - 1.0f / far)
+                          : (top - 1) / (far - near));
+    const float bias = METRIC ? 0 : 1.5f;
+
+    for (int y = begin; y < end; y++) {
+        const float *source = depth.ptr<float>(y);
+        T *target = out.ptr<T>(y);
+        for (int x = 0; x < depth.cols; x++) {
+            float value = source[x];
+            float clamped = value < near ? near : value;
+            float steps = INVERSE ? (1.0f / clamped - origin) * scale
+                                  : (origin - clamped) * scale;
+            bool valid = value <= far && value != 0;
+            // select before converting, NaN and inf never reach the cast
+            target[x] = T(valid ? steps + bias : 0.0f);
+        }
+    }
+}
+
+template <typename T>
+void quantizeAll(const cv::Mat &depth, cv::Mat &out,
+                 DepthQuantizer::Parameters parameters) {
+    cv::parallel_for_(cv::Range(0, depth.rows), [&](const cv::Range &rows) {
+        if (parameters.mapping == DepthQuantizer::INVERSE)
+            quantizeRows<T, true>(depth, out, parameters, rows.start, rows.end);
+        else
+            quantizeRows<T, false>(depth, out, parameters, rows.start,
+                                   rows.end);
+    });
+}
+
+}  // namespace
+
+DepthQuantizer::DepthQuantizer(Parameters parameters) {
+    setParameters(parameters);
+}
+
+void DepthQuantizer::setParameters(Parameters parameters) {
+    if (parameters.near <= 0 || parameters.far <= parameters.near)
+        throw std::runtime_error("Depth range needs 0 < near < far");
+    if (parameters.bits != 8 && parameters.bits != 16 && parameters.bits != 32)
+        throw std::runtime_error("Depth is quantized to 8, 16 or 32 bits");
+    m_parameters = parameters;
+}
+
+void DepthQuantizer::quantize(const cv::Mat &depth, cv::Mat &out) const {
+    if (depth.type() != CV_32FC1)
+        throw std::runtime_error("Metric depth has to be CV_32FC1");
+
+    out.create(depth.size(), outputType());
+    switch (m_parameters.bits) {
+        case 16:
+            quantizeAll<ushort>(depth, out, m_parameters);
+            break;
+        case 32:
+            quantizeAll<float>(depth, out, m_parameters);
+            break;
+        default:
+            quantizeAll<uchar>(depth, out, m_parameters);
+            break;
+    }
+}
+
+void DepthQuantizer::toInteger(const cv::Mat &working, int bits,
+                               cv::Mat &out) const {
+    if (working.type() != CV_32FC1)
+        throw std::runtime_error("Float working image has to be CV_32FC1");
+    if (bits != 8 && bits != 16)
+        throw std::runtime_error("Depth is converted to 8 or 16 bits");
+
+    const float near = m_parameters.near;
+    const float far = m_parameters.far;
+    const float top = bits == 16 ? 65535.0f : 255.0f;
+    const float range = m_parameters.mapping == INVERSE
+                            ? 1.0f / near - 1.0f / far
+                            : far - near;
+    // 0 marks pixels without depth, the rest lands in [1, top] rounded
+    cv::Mat unknown = working == 0;
+    working.convertTo(out, bits == 16 ? CV_16U : CV_8U, (top - 1) / range, 1);
+    out.setTo(0, unknown);
+}
@@ -0,0 +1,95 @@
+#include "../headers/events.hpp"
+
+int EventBus::subscribe(std::string name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_subscribers.push_back({name});
+    return m_subscribers.size() - 1;
+}
+
+void EventBus::post(Event event) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &subscriber : m_subscribers) subscriber.pending |= event;
+
+        for (int i = 0; i < EVENT_COUNT; i++)
+            if (event & (1 << i)) m_posted.at(i)++;
+
+        m_printer.log_message({Printer::INFO,
+                               {0},
+                               "event posted: " + name(event),
+                               Printer::DEBUG_LVL::VERBOSE});
+    }
+    m_condition.notify_all();
+}
+
+uint32_t EventBus::wait(int subscriber, uint32_t interest) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto &sub = m_subscribers.at(subscriber);
+    m_condition.wait(lock, [&sub, interest] { return sub.pending & interest; });
+
+    return consume(sub, interest);
+}
+
+uint32_t EventBus::waitFor(int subscriber, uint32_t interest,
+                           std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto &sub = m_subscribers.at(subscriber);
+    if (!m_condition.wait_for(lock, timeout, [&sub, interest] {
+            return sub.pending & interest;
+        }))
+        return NONE;
+
+    return consume(sub, interest);
+}
+
+uint32_t EventBus::poll(int subscriber, uint32_t interest) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &sub = m_subscribers.at(subscriber);
+    if (!(sub.pending & interest)) return NONE;
+
+    return consume(sub, interest);
+}
+
+void EventBus::printStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        m_printer.log_message({Printer::INFO,
+                               {m_posted.at(i)},
+                               "events " + name(Event(1 << i)),
+                               Printer::DEBUG_LVL::BRIEF});
+    }
+    for (const auto &subscriber : m_subscribers) {
+        m_printer.log_message({Printer::INFO,
+                               {subscriber.wakeups},
+                               "wakeups of " + subscriber.name,
+                               Printer::DEBUG_LVL::BRIEF});
+    }
+}
+
+std::string EventBus::name(Event event) {
+    std::string names;
+    const std::array<std::string, EVENT_COUNT> event_names = {
+        "FRAME_GRABBED",         "RESULT_READY",     "SETTINGS_CHANGED",
+        "CALIBRATION_REQUESTED", "CALIBRATION_DONE", "SHUTDOWN"};
+
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (!(event & (1 << i))) continue;
+        if (!names.empty()) names += "|";
+        names += event_names.at(i);
+    }
+    return names.empty() ? "NONE" : names;
+}
+
+uint32_t EventBus::consume(Subscriber &subscriber, uint32_t interest) {
+    uint32_t events = subscriber.pending & interest;
+    // Shutdown is never consumed, every later wait returns immediately
+    subscriber.pending &= ~(interest & ~SHUTDOWN);
+    subscriber.wakeups++;
+
+    m_printer.log_message({Printer::INFO,
+                           {0},
+                           subscriber.name + " woke up on " +
+                               name(Event(events)),
+                           Printer::DEBUG_LVL::VERBOSE});
+    return events;
+}
@@ -0,0 +1,215 @@
+#include "../headers/frame_source.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+ViewDemand ViewDemand::capture(const InteractiveState &state,
+                               const Config &config,
+                               const bool &save_calibration) {
+    return ViewDemand({
+        {"segmentation", FrameSource::DEPTH,
+         [&state] {
+             return state.mode == InteractiveState::Mode::OBJECTS ||
+                    state.mode == InteractiveState::Mode::TEMPLATES;
+         }},
+        {"recorder", FrameSource::DEPTH, [&config] { return config.record; }},
+        {"movement", FrameSource::DEPTH,
+         [&config, &save_calibration] {
+             return config.movement_every > 0 || save_calibration;
+         }},
+    });
+}
+
+uint32_t ViewDemand::required(bool metric_depth) const {
+    uint32_t views = 0;
+    for (const auto &consumer : m_consumers)
+        if (consumer.active()) views |= consumer.views;
+
+    if ((views & FrameSource::DEPTH) && metric_depth)
+        views = (views & ~FrameSource::DEPTH) | FrameSource::METRIC_DEPTH;
+    return views;
+}
+
+void ReplayFrameSource::open(Config config) {
+    m_path = config.file_path;
+    m_max_speed = config.replay_max_speed;
+    m_timestamps.clear();
+    m_recording.reset();
+    m_calibration_id = -1;
+    m_roi = cv::Mat();
+    m_has_gray = m_has_color = m_has_metric = false;
+
+    if (fs::is_regular_file(m_path)) {
+        m_recording = std::make_shared<RecordingReader>(m_path);
+        m_frame_count = m_recording->frameCount();
+        for (int i = 0; i < m_frame_count; i++)
+            m_timestamps.push_back(m_recording->entry(i).timestamp_ns);
+    } else if (fs::is_directory(m_path)) {
+        m_frame_count = 0;
+        while (fs::exists(framePath("depth", m_frame_count))) m_frame_count++;
+
+        std::ifstream file(m_path + "/timestamps.txt");
+        long long timestamp;
+        while (file >> timestamp) m_timestamps.push_back(timestamp);
+
+        m_has_gray = fs::exists(framePath("gray", 0));
+        m_has_color = fs::exists(framePath("color", 0));
+        m_has_metric = fs::exists(framePath("metric", 0, "tiff"));
+        cv::Mat first =
+            cv::imread(framePath("depth", 0), cv::IMREAD_UNCHANGED);
+        m_depth_size = first.size();
+        m_depth_elem = first.elemSize();
+    } else {
+        throw std::runtime_error("Replay source not found: " + m_path);
+    }
+    if (m_frame_count == 0)
+        throw std::runtime_error("No depth frames in " + m_path);
+
+    // Recorded pace, evenly spaced frames if there is no record of it
+    if (m_timestamps.size() < m_frame_count) {
+        m_timestamps.clear();
+        for (int i = 0; i < m_frame_count; i++)
+            m_timestamps.push_back(i * DEFAULT_FRAME_NS);
+    }
+    const long long base = m_timestamps.front();
+    for (auto &value : m_timestamps) value -= base;
+
+    m_intrinsics = {};
+    cv::FileStorage intrinsics(m_path + "/intrinsics.yml",
+                               cv::FileStorage::READ);
+    if (!m_recording && intrinsics.isOpened()) {
+        intrinsics["fx"] >> m_intrinsics.fx;
+        intrinsics["fy"] >> m_intrinsics.fy;
+        intrinsics["cx"] >> m_intrinsics.cx;
+        intrinsics["cy"] >> m_intrinsics.cy;
+    }
+
+    m_position = -1;
+    m_started = FrameTimestamps::clock::now();
+
+    m_printer.log_message({Printer::INFO,
+                           {m_frame_count},
+                           "Replay contains (frames)",
+                           Printer::DEBUG_LVL::PRODUCTION});
+}
+
+bool ReplayFrameSource::grab() {
+    if (finished()) return false;
+    m_position++;
+
+    if (!m_max_speed)
+        std::this_thread::sleep_until(
+            m_started + std::chrono::nanoseconds(m_timestamps.at(m_position)));
+
+    m_captured = FrameTimestamps::clock::now();
+    return true;
+}
+
+bool ReplayFrameSource::retrieve(SourceFrame &frame, uint32_t views) {
+    if (m_position < 0 || m_position >= m_frame_count) return false;
+
+    frame.captured = m_captured;
+    frame.depth = cv::Mat();
+    frame.gray = cv::Mat();
+    frame.color = cv::Mat();
+    frame.metric_depth = cv::Mat();
+    frame.buffers.reset();
+
+    // Recordings and directories without metric depth hold the working
+    // image only, quantized when it was recorded
+    if ((views & METRIC_DEPTH) && !m_has_metric)
+        views = (views & ~METRIC_DEPTH) | DEPTH;
+    countRetrieval(views);
+
+    if (m_recording) {
+        uint32_t calibration = m_recording->entry(m_position).calibration_id;
+        if (calibration != m_calibration_id) {
+            m_homography = m_recording->homography(calibration);
+            m_calibration_id = calibration;
+        }
+
+        if (!(views & DEPTH)) return true;
+        frame.depth = m_recording->frame(m_position);
+        // Raw frames are views into the mapping, which the lease keeps open
+        if (m_recording->entry(m_position).encoding == RecordingFormat::RAW)
+            frame.buffers = m_recording;
+        return !frame.depth.empty();
+    }
+
+    if (views & DEPTH)
+        frame.depth = cv::imread(framePath("depth", m_position),
+                                 cv::IMREAD_UNCHANGED);
+
+    // Optional views stay empty when they were not recorded
+    auto optional = [this](std::string view, int flags,
+                           std::string extension = "png") -> cv::Mat {
+        std::string path = framePath(view, m_position, extension);
+        return fs::exists(path) ? cv::imread(path, flags) : cv::Mat();
+    };
+    if (views & GRAY) frame.gray = optional("gray", cv::IMREAD_GRAYSCALE);
+    if (views & COLOR) frame.color = optional("color", cv::IMREAD_UNCHANGED);
+    if (views & METRIC_DEPTH)
+        frame.metric_depth =
+            optional("metric", cv::IMREAD_UNCHANGED, "tiff");
+
+    return !(views & DEPTH) || !frame.depth.empty();
+}
+
+size_t ReplayFrameSource::viewBytes(View view) {
+    if (m_recording) {
+        if (view != DEPTH) return 0;
+        cv::Size size = m_recording->size();
+        return size.area() * (m_recording->type() == CV_16UC1 ? 2 : 1);
+    }
+
+    // Estimated from the first depth frame
+    size_t pixels = m_depth_size.area();
+    switch (view) {
+        case DEPTH:
+            return pixels * m_depth_elem;
+        case GRAY:
+            return m_has_gray ? pixels : 0;
+        case COLOR:
+            return m_has_color ? 3 * pixels : 0;
+        case METRIC_DEPTH:
+            return m_has_metric ? 4 * pixels : 0;
+        default:
+            return 0;
+    }
+}
+
+bool ReplayFrameSource::finished() { return m_position + 1 >= m_frame_count; }
+
+bool ReplayFrameSource::calibrate(OutputSink &, InteractiveState &state,
+                                  std::string,
+                                  CalibrationDetector::Parameters) {
+    // Nothing is projected, the recorded calibration is used as is
+    state.calibrate = false;
+    if (m_recording) {
+        int first = std::max(m_position, 0);
+        m_calibration_id = m_recording->entry(first).calibration_id;
+        m_homography = m_recording->homography(m_calibration_id);
+        return true;
+    }
+
+    m_homography = cv::Mat::eye(3, 3, CV_64F);
+    cv::FileStorage storage(m_path + "/homography.yml",
+                            cv::FileStorage::READ);
+    if (storage.isOpened()) storage["homography"] >> m_homography;
+
+    std::string roi_path = m_path + "/roi.png";
+    if (fs::exists(roi_path))
+        m_roi = cv::imread(roi_path, cv::IMREAD_GRAYSCALE);
+    return true;
+}
+
+std::string ReplayFrameSource::framePath(std::string view, int index,
+                                         std::string extension) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s_%06d.%s", view.c_str(), index,
+             extension.c_str());
+    return m_path + "/" + name;
+}
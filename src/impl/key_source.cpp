@@ -0,0 +1,85 @@
+#include "../headers/key_source.hpp"
+
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+
+#include "opencv2/highgui.hpp"
+
+namespace {
+
+// The signal handler exits without unwinding, so the terminal is also
+// restored at exit
+termios saved_terminal;
+bool terminal_changed = false;
+
+void restoreTerminal() {
+    if (terminal_changed) tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal);
+    terminal_changed = false;
+}
+
+}  // namespace
+
+KeySource::Type KeySource::parse(std::string name) {
+    if (name == "window") return WINDOW;
+    if (name == "terminal") return TERMINAL;
+    if (name == "none") return NONE;
+    throw std::runtime_error("Unknown key source: " + name);
+}
+
+std::unique_ptr<KeySource> KeySource::make(Type type) {
+    switch (type) {
+        case WINDOW:
+            return std::make_unique<HighGuiKeySource>();
+        case TERMINAL:
+            return std::make_unique<TerminalKeySource>();
+        default:
+            return std::make_unique<NoKeySource>();
+    }
+}
+
+int HighGuiKeySource::read(int timeout) { return cv::waitKey(timeout); }
+
+TerminalKeySource::TerminalKeySource() {
+    if (terminal_changed || !isatty(STDIN_FILENO) ||
+        tcgetattr(STDIN_FILENO, &saved_terminal) != 0)
+        return;
+
+    termios raw = saved_terminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    terminal_changed = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+
+    static bool registered = false;
+    if (!registered) registered = std::atexit(restoreTerminal) == 0;
+}
+
+TerminalKeySource::~TerminalKeySource() { restoreTerminal(); }
+
+int TerminalKeySource::read(int timeout) {
+    fd_set input;
+    FD_ZERO(&input);
+    FD_SET(STDIN_FILENO, &input);
+
+    timeval wait{timeout / 1000, (timeout % 1000) * 1000};
+    int ready = select(STDIN_FILENO + 1, &input, nullptr, nullptr,
+                       timeout > 0 ? &wait : nullptr);
+    if (ready <= 0) return -1;
+
+    unsigned char key;
+    if (::read(STDIN_FILENO, &key, 1) != 1) return -1;
+    return key;
+}
+
+int NoKeySource::read(int timeout) {
+    // Nothing will ever come, do not block forever
+    if (timeout > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+    return -1;
+}
@@ -0,0 +1,106 @@
+#include "../headers/latency.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+LatencyTracer::LatencyTracer(Printer printer, int period_seconds)
+    : m_printer(printer),
+      m_period(period_seconds),
+      m_last_report(FrameTimestamps::clock::now()) {}
+
+void LatencyTracer::record(const FrameTimestamps &timestamps) {
+    auto micros = [](auto from, auto to) -> int {
+        return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+            .count();
+    };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto previous = timestamps.captured;
+    for (int hop = 0; hop < FrameTimestamps::HOP_COUNT; hop++) {
+        m_samples.at(hop).at(m_next) = micros(previous, timestamps.at[hop]);
+        previous = timestamps.at[hop];
+    }
+    m_samples.at(GLASS_TO_GLASS).at(m_next) =
+        micros(timestamps.captured, timestamps.at[FrameTimestamps::IMSHOW]);
+
+    m_next = (m_next + 1) % WINDOW;
+    m_filled = std::min(m_filled + 1, WINDOW);
+    m_frames++;
+}
+
+LatencyTracer::Percentiles LatencyTracer::percentiles(int series) {
+    std::vector<int> samples;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &ring = m_samples.at(series);
+        samples.assign(ring.begin(), ring.begin() + m_filled);
+    }
+    if (samples.empty()) return {};
+
+    auto at = [&samples](double fraction) -> int {
+        auto nth = samples.begin() + int(fraction * (samples.size() - 1));
+        std::nth_element(samples.begin(), nth, samples.end());
+        return *nth;
+    };
+
+    Percentiles result;
+    result.samples = samples.size();
+    result.p50 = at(0.50);
+    result.p95 = at(0.95);
+    result.p99 = at(0.99);
+    result.max = *std::max_element(samples.begin(), samples.end());
+    return result;
+}
+
+bool LatencyTracer::report() {
+    if (m_period.count() <= 0) return false;
+
+    auto now = FrameTimestamps::clock::now();
+    if (now - m_last_report < m_period) return false;
+    m_last_report = now;
+
+    print();
+    return true;
+}
+
+void LatencyTracer::print() {
+    for (int series = 0; series < SERIES; series++) {
+        auto [p50, p95, p99, max, samples] = percentiles(series);
+        if (samples == 0) continue;
+
+        m_printer.log_message({Printer::INFO_LATENCY,
+                               {p50, p95, p99, max},
+                               name(series),
+                               Printer::DEBUG_LVL::BRIEF});
+    }
+}
+
+void LatencyTracer::dumpJson(std::string path) {
+    std::string hops = "";
+    for (int series = 0; series < SERIES; series++) {
+        auto [p50, p95, p99, max, samples] = percentiles(series);
+        hops += "{\"name\": \"" + name(series) +
+                "\", \"samples\": " + std::to_string(samples) +
+                ", \"p50_us\": " + std::to_string(p50) +
+                ", \"p95_us\": " + std::to_string(p95) +
+                ", \"p99_us\": " + std::to_string(p99) +
+                ", \"max_us\": " + std::to_string(max) + "},";
+    }
+    hops.pop_back();
+
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "[ERROR]: Failed to open latency file" << std::endl;
+        return;
+    }
+    file << "{\"frames\": " << m_frames << ", \"hops\": [" << hops << "]}"
+         << std::endl;
+}
+
+std::string LatencyTracer::name(int series) {
+    const std::array<std::string, SERIES> names = {
+        "grab",         "retrieve",    "warp",   "morphology",
+        "segmentation", "compositing", "imshow", "glass_to_glass"};
+    return names.at(series);
+}
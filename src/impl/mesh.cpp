@@ -0,0 +1,352 @@
+#include "../headers/mesh.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+// Turns per row counts, stored from index 1 on, into row starts
+int prefixSum(std::vector<int> &offsets) {
+    offsets[0] = 0;
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    return offsets.back();
+}
+
+constexpr int BOTH = GridMesher::UPPER_LEFT | GridMesher::LOWER_RIGHT;
+
+// Triangles of the 2x2 block at x, y that have three finite points
+inline int pixelTriangles(const cv::Mat &finite, int x, int y) {
+    const uchar *top = finite.ptr<uchar>(y);
+    const uchar *bottom = finite.ptr<uchar>(y + 1);
+    int upper = top[x] & top[x + 1] & bottom[x];
+    int lower = top[x + 1] & bottom[x] & bottom[x + 1];
+    return upper * GridMesher::UPPER_LEFT | lower * GridMesher::LOWER_RIGHT;
+}
+
+// Leaves of neighbouring roots share corners, so marks are atomic
+inline void markUsed(cv::Mat &index, int x, int y) {
+    std::atomic_ref<int>(index.at<int>(y, x))
+        .store(0, std::memory_order_relaxed);
+}
+
+inline bool used(cv::Mat &index, int x, int y) {
+    return std::atomic_ref<int>(index.at<int>(y, x))
+               .load(std::memory_order_relaxed) >= 0;
+}
+
+void markFinite(const cv::Mat &cloud, cv::Mat &finite) {
+    finite.create(cloud.size(), CV_8U);
+    cv::parallel_for_(cv::Range(0, cloud.rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const cv::Vec4f *points = cloud.ptr<cv::Vec4f>(y);
+            uchar *row = finite.ptr<uchar>(y);
+            for (int x = 0; x < cloud.cols; x++)
+                row[x] = std::isfinite(points[x][0]) &
+                         std::isfinite(points[x][1]) &
+                         std::isfinite(points[x][2]);
+        }
+    });
+}
+
+// Numbers the used points of index (>= 0) in row order and copies them
+// into vertices; offsets hold the used points per row from index 1 on
+void numberVertices(const cv::Mat &cloud, cv::Mat &index,
+                    std::vector<int> &offsets,
+                    std::vector<cv::Vec4f> &vertices) {
+    // Only growth initializes, everything is overwritten below
+    vertices.resize(prefixSum(offsets));
+
+    cv::parallel_for_(cv::Range(0, cloud.rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const cv::Vec4f *points = cloud.ptr<cv::Vec4f>(y);
+            int *row = index.ptr<int>(y);
+            int next = offsets[y];
+            for (int x = 0; x < cloud.cols; x++) {
+                if (row[x] < 0) continue;
+                vertices[next] = points[x];
+                row[x] = next++;
+            }
+        }
+    });
+}
+
+}  // namespace
+
+void GridMesher::triangulate(const cv::Mat &cloud, Mesh &mesh) {
+    if (cloud.type() != CV_32FC4)
+        throw std::runtime_error("Point cloud has to be CV_32FC4");
+
+    const int rows = cloud.rows;
+    const int cols = cloud.cols;
+    if (rows < 2 || cols < 2) {
+        mesh.clear();
+        return;
+    }
+
+    m_triangles.create(rows - 1, cols - 1, CV_8U);
+    m_index.create(rows, cols, CV_32S);
+    m_vertex_offsets.resize(rows + 1);
+    m_triangle_offsets.resize(rows);
+
+    markFinite(cloud, m_finite);
+
+    // Triangles of every block, counted per block row
+    cv::parallel_for_(cv::Range(0, rows - 1), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const uchar *top = m_finite.ptr<uchar>(y);
+            const uchar *bottom = m_finite.ptr<uchar>(y + 1);
+            uchar *triangles = m_triangles.ptr<uchar>(y);
+            int count = 0;
+            for (int x = 0; x < cols - 1; x++) {
+                int upper = top[x] & top[x + 1] & bottom[x];
+                int lower = top[x + 1] & bottom[x] & bottom[x + 1];
+                triangles[x] = upper * UPPER_LEFT | lower * LOWER_RIGHT;
+                count += upper + lower;
+            }
+            m_triangle_offsets[y + 1] = count;
+        }
+    });
+
+    // A point is used by the blocks it is a corner of: as v0 of its own,
+    // v1 of the left, v2 of the upper and v3 of the upper left one
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const uchar *below = y < rows - 1 ? m_triangles.ptr<uchar>(y)
+                                              : nullptr;
+            const uchar *above = y > 0 ? m_triangles.ptr<uchar>(y - 1)
+                                       : nullptr;
+            int *index = m_index.ptr<int>(y);
+            int count = 0;
+            for (int x = 0; x < cols; x++) {
+                int used = 0;
+                if (below) {
+                    if (x < cols - 1) used |= below[x] & UPPER_LEFT;
+                    if (x > 0) used |= below[x - 1];
+                }
+                if (above) {
+                    if (x < cols - 1) used |= above[x];
+                    if (x > 0) used |= above[x - 1] & LOWER_RIGHT;
+                }
+                index[x] = used ? 0 : -1;
+                count += used != 0;
+            }
+            m_vertex_offsets[y + 1] = count;
+        }
+    });
+
+    numberVertices(cloud, m_index, m_vertex_offsets, mesh.vertices);
+    mesh.triangles.resize(prefixSum(m_triangle_offsets));
+
+    cv::parallel_for_(cv::Range(0, rows - 1), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const uchar *triangles = m_triangles.ptr<uchar>(y);
+            const int *top = m_index.ptr<int>(y);
+            const int *bottom = m_index.ptr<int>(y + 1);
+            int next = m_triangle_offsets[y];
+            for (int x = 0; x < cols - 1; x++) {
+                if (triangles[x] & UPPER_LEFT)
+                    mesh.triangles[next++] = {top[x], top[x + 1], bottom[x]};
+                if (triangles[x] & LOWER_RIGHT)
+                    mesh.triangles[next++] = {top[x + 1], bottom[x],
+                                              bottom[x + 1]};
+            }
+        }
+    });
+}
+
+QuadtreeMesher::QuadtreeMesher(Parameters parameters) {
+    setParameters(parameters);
+}
+
+void QuadtreeMesher::setParameters(Parameters parameters) {
+    if (parameters.max_error < 0)
+        throw std::runtime_error("Mesh error bound has to be positive");
+    if (parameters.root < 1 || (parameters.root & (parameters.root - 1)))
+        throw std::runtime_error("Quadtree roots are a power of two");
+    m_parameters = parameters;
+}
+
+bool QuadtreeMesher::flat(const cv::Mat &cloud, int x, int y,
+                          int size) const {
+    auto point = [&](int column, int row) {
+        const cv::Vec4f &value = cloud.at<cv::Vec4f>(row, column);
+        return cv::Vec3f(value[0], value[1], value[2]);
+    };
+    cv::Vec3f top_left = point(x, y);
+    cv::Vec3f top_right = point(x + size, y);
+    cv::Vec3f bottom_left = point(x, y + size);
+    cv::Vec3f bottom_right = point(x + size, y + size);
+
+    // Unnormalized, distances are compared scaled by the normal length
+    cv::Vec3f upper = (top_right - top_left).cross(bottom_left - top_left);
+    cv::Vec3f lower =
+        (bottom_right - top_right).cross(bottom_left - top_right);
+    float upper_bound = m_parameters.max_error * float(cv::norm(upper));
+    float lower_bound = m_parameters.max_error * float(cv::norm(lower));
+    if (upper_bound == 0 || lower_bound == 0) return false;
+
+    for (int row = y; row <= y + size; row++) {
+        const uchar *finite = m_finite.ptr<uchar>(row);
+        const cv::Vec4f *points = cloud.ptr<cv::Vec4f>(row);
+        for (int column = x; column <= x + size; column++) {
+            if (!finite[column]) return false;
+            cv::Vec3f p(points[column][0], points[column][1],
+                        points[column][2]);
+            bool in_upper = (column - x) + (row - y) <= size;
+            float distance = in_upper ? upper.dot(p - top_left)
+                                      : lower.dot(p - top_right);
+            if (std::abs(distance) > (in_upper ? upper_bound : lower_bound))
+                return false;
+        }
+    }
+    return true;
+}
+
+void QuadtreeMesher::split(const cv::Mat &cloud, int x, int y, int size,
+                           std::vector<Leaf> &leaves) {
+    if (x >= cloud.cols - 1 || y >= cloud.rows - 1) return;
+
+    bool inside = x + size < cloud.cols && y + size < cloud.rows;
+    if (size == 1 || (inside && flat(cloud, x, y, size))) {
+        leaves.push_back({x, y, size, false, 0});
+        return;
+    }
+
+    int half = size / 2;
+    split(cloud, x, y, half, leaves);
+    split(cloud, x + half, y, half, leaves);
+    split(cloud, x, y + half, half, leaves);
+    split(cloud, x + half, y + half, half, leaves);
+}
+
+void QuadtreeMesher::emit(const Leaf &leaf, cv::Vec3i *triangles) const {
+    auto index = [&](int column, int row) {
+        return m_index.at<int>(row, column);
+    };
+    int x = leaf.x, y = leaf.y, size = leaf.size;
+    int top_left = index(x, y);
+    int top_right = index(x + size, y);
+    int bottom_left = index(x, y + size);
+    int bottom_right = index(x + size, y + size);
+
+    if (!leaf.fan) {
+        // Consistently wound, unlike the single pixel triangles of
+        // GridMesher
+        int mask = size > 1 ? BOTH : pixelTriangles(m_finite, x, y);
+        if (mask & GridMesher::UPPER_LEFT)
+            *triangles++ = {top_left, top_right, bottom_left};
+        if (mask & GridMesher::LOWER_RIGHT)
+            *triangles++ = {top_right, bottom_right, bottom_left};
+        return;
+    }
+
+    // Around the edges from the top left corner, in the same direction
+    int centre = index(x + size / 2, y + size / 2);
+    int first = top_left;
+    int previous = top_left;
+    auto step = [&](int column, int row) {
+        int current = index(column, row);
+        if (current < 0) return;
+        *triangles++ = {centre, previous, current};
+        previous = current;
+    };
+    for (int i = 1; i <= size; i++) step(x + i, y);
+    for (int i = 1; i <= size; i++) step(x + size, y + i);
+    for (int i = size - 1; i >= 0; i--) step(x + i, y + size);
+    for (int i = size - 1; i > 0; i--) step(x, y + i);
+    *triangles++ = {centre, previous, first};
+}
+
+void QuadtreeMesher::triangulate(const cv::Mat &cloud, Mesh &mesh) {
+    if (cloud.type() != CV_32FC4)
+        throw std::runtime_error("Point cloud has to be CV_32FC4");
+
+    const int rows = cloud.rows;
+    const int cols = cloud.cols;
+    if (rows < 2 || cols < 2) {
+        mesh.clear();
+        return;
+    }
+
+    const int root = m_parameters.root;
+    const int roots_x = (cols - 2) / root + 1;
+    const int roots_y = (rows - 2) / root + 1;
+    const int roots = roots_x * roots_y;
+    m_leaves.resize(roots);
+    m_triangle_offsets.resize(roots + 1);
+    m_vertex_offsets.resize(rows + 1);
+
+    markFinite(cloud, m_finite);
+    m_index.create(rows, cols, CV_32S);
+    m_index.setTo(-1);
+
+    // Leaves and the points their triangles use
+    cv::parallel_for_(cv::Range(0, roots), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            std::vector<Leaf> &leaves = m_leaves[i];
+            leaves.clear();
+            split(cloud, i % roots_x * root, i / roots_x * root, root, leaves);
+
+            for (Leaf &leaf : leaves) {
+                int x = leaf.x, y = leaf.y, size = leaf.size;
+                int mask = size > 1 ? BOTH : pixelTriangles(m_finite, x, y);
+                leaf.triangles = (mask & 1) + (mask >> 1 & 1);
+                if (mask & GridMesher::UPPER_LEFT) markUsed(m_index, x, y);
+                if (mask & GridMesher::LOWER_RIGHT)
+                    markUsed(m_index, x + size, y + size);
+                if (mask) {
+                    markUsed(m_index, x + size, y);
+                    markUsed(m_index, x, y + size);
+                }
+            }
+        }
+    });
+
+    // Squares with smaller neighbours take their vertices into a fan. Only
+    // edges are read and only centres written, which never coincide.
+    cv::parallel_for_(cv::Range(0, roots), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            int count = 0;
+            for (Leaf &leaf : m_leaves[i]) {
+                int x = leaf.x, y = leaf.y, size = leaf.size;
+                int boundary = 4;
+                for (int j = 1; j < size; j++)
+                    boundary += used(m_index, x + j, y) +
+                                used(m_index, x + j, y + size) +
+                                used(m_index, x, y + j) +
+                                used(m_index, x + size, y + j);
+                leaf.fan = boundary > 4;
+                if (leaf.fan) {
+                    markUsed(m_index, x + size / 2, y + size / 2);
+                    leaf.triangles = boundary;
+                }
+                count += leaf.triangles;
+            }
+            m_triangle_offsets[i + 1] = count;
+        }
+    });
+
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const int *index = m_index.ptr<int>(y);
+            int count = 0;
+            for (int x = 0; x < cols; x++) count += index[x] >= 0;
+            m_vertex_offsets[y + 1] = count;
+        }
+    });
+    numberVertices(cloud, m_index, m_vertex_offsets, mesh.vertices);
+    mesh.triangles.resize(prefixSum(m_triangle_offsets));
+
+    cv::parallel_for_(cv::Range(0, roots), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            cv::Vec3i *triangles =
+                mesh.triangles.data() + m_triangle_offsets[i];
+            for (const Leaf &leaf : m_leaves[i]) {
+                emit(leaf, triangles);
+                triangles += leaf.triangles;
+            }
+        }
+    });
+}
@@ -0,0 +1,75 @@
+#include "../headers/movement.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+MovementDetector::MovementDetector() : MovementDetector(Parameters()) {}
+
+MovementDetector::MovementDetector(Parameters parameters)
+    : m_parameters(parameters) {}
+
+void MovementDetector::setParameters(Parameters parameters) {
+    m_parameters = parameters;
+    reset();
+}
+
+void MovementDetector::reset() {
+    m_reference.release();
+    m_frames = 0;
+    m_moved = 0;
+    m_shift = cv::Point2d(0, 0);
+}
+
+void MovementDetector::setReference(const cv::Mat &thumbnail) {
+    reset();
+    thumbnail.copyTo(m_reference);
+    cv::createHanningWindow(m_window, m_reference.size(), CV_32F);
+}
+
+bool MovementDetector::observe(const cv::Mat &image) {
+    if (image.empty()) return false;
+    if (!m_reference.empty() && ++m_frames % m_parameters.every != 0)
+        return false;
+
+    cv::Point2d shift;
+    if (!measure(image, shift)) return false;
+
+    if (std::hypot(shift.x, shift.y) > m_parameters.max_shift)
+        m_moved++;
+    else
+        m_moved = 0;
+    return m_moved >= m_parameters.sustained;
+}
+
+bool MovementDetector::matches(const cv::Mat &image) {
+    cv::Point2d shift;
+    return !image.empty() && !m_reference.empty() && measure(image, shift) &&
+           std::hypot(shift.x, shift.y) <= m_parameters.max_shift;
+}
+
+bool MovementDetector::measure(const cv::Mat &image, cv::Point2d &shift) {
+    shrink(image, m_thumbnail);
+    if (m_reference.empty() || m_reference.size() != m_thumbnail.size()) {
+        setReference(m_thumbnail);
+        return false;
+    }
+
+    double response = 0;
+    shift = cv::phaseCorrelate(m_reference, m_thumbnail, m_window, &response);
+    if (response < m_parameters.min_response) return false;
+
+    m_shift = shift * (double(image.cols) / m_thumbnail.cols);
+    return true;
+}
+
+void MovementDetector::shrink(const cv::Mat &image, cv::Mat &thumbnail) {
+    int width = m_parameters.width;
+    int height = std::max(1, image.rows * width / std::max(1, image.cols));
+
+    // Colour conversion only on the few pixels left
+    cv::Mat small;
+    cv::resize(image, small, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+    if (small.channels() == 4) cv::cvtColor(small, small, cv::COLOR_BGRA2GRAY);
+    if (small.channels() == 3) cv::cvtColor(small, small, cv::COLOR_BGR2GRAY);
+    small.convertTo(thumbnail, CV_32F);
+}
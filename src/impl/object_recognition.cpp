@@ -6,6 +6,16 @@ using namespace std;
 using namespace cv;
 namespace fs = std::filesystem;
 
+namespace {
+
+// Depth images segmentation runs on
+bool supportedDepth(const cv::Mat &image) {
+    int depth = image.depth();
+    return depth == CV_8U || depth == CV_16U || depth == CV_32F;
+}
+
+}  // namespace
+
 ImageProcessor::ImageProcessor(string output_location, Logger &log,
                                Printer &printer)
     : m_log(log), m_printer(printer) {
@@ -16,8 +26,8 @@ ImageProcessor::ImageProcessor(string path, string output_location, Logger &log,
                                Printer &printer)
     : m_log(log), m_printer(printer) {
     // TODO check if image exists
-    (*image) = imread(path, IMREAD_GRAYSCALE);
-    CV_Assert((*image).depth() == CV_8U);
+    (*image) = imread(path, IMREAD_GRAYSCALE | IMREAD_ANYDEPTH);
+    CV_Assert(supportedDepth(*image));
     if ((*image).empty()) return;
 
     m_objects = cv::Mat((*image).rows, (*image).cols, CV_8U, double(0));
@@ -29,7 +39,7 @@ ImageProcessor::ImageProcessor(cv::Mat o_image, std::string output_location,
     : m_log(log), m_printer(printer) {
     // todo fix
     (*image) = o_image;
-    CV_Assert((*image).depth() == CV_8U);
+    CV_Assert(supportedDepth(*image));
     if ((*image).empty()) return;
 
     m_objects = cv::Mat((*image).rows, (*image).cols, CV_8U, double(0));
@@ -38,8 +48,8 @@ ImageProcessor::ImageProcessor(cv::Mat o_image, std::string output_location,
 
 void ImageProcessor::getImage(string path) {
     // TODO add checks, return error
-    cv::Mat new_image = imread(path, IMREAD_GRAYSCALE);
-    CV_Assert(new_image.depth() == CV_8U);
+    cv::Mat new_image = imread(path, IMREAD_GRAYSCALE | IMREAD_ANYDEPTH);
+    CV_Assert(supportedDepth(new_image));
     if (new_image.empty()) return;
     (*image) = new_image;
 
@@ -48,7 +58,7 @@ void ImageProcessor::getImage(string path) {
 
 void ImageProcessor::getImage(cv::Mat *new_image) {
     // TODO add checks, return error
-    CV_Assert((*new_image).depth() == CV_8U);
+    CV_Assert(supportedDepth(*new_image));
     CV_Assert((*new_image).channels() == 1);
     CV_Assert((*new_image).empty() == false);
     // (*image) = new_image;
@@ -100,6 +110,33 @@ cv::Mat ImageProcessor::dilate(int dilation_dst, int dilation_size) {
 }
 
 void ImageProcessor::findObjects() {
+    switch ((*image).depth()) {
+        case CV_8U:
+            findObjectsOf<uchar>();
+            break;
+        case CV_16U:
+            findObjectsOf<ushort>();
+            break;
+        case CV_32F:
+            findObjectsOf<float>();
+            break;
+        default:
+            throw runtime_error("Unsupported depth image type");
+    }
+}
+
+template <typename T>
+ImageProcessor::Limits<T> ImageProcessor::limitsOf() const {
+    // Float depth is metric, the thresholds are given in millimetres
+    double unit = std::is_floating_point_v<T> ? 0.001 : 1;
+    using Value = typename Limits<T>::Value;
+    return {Value(m_parameters.z_limit * unit),
+            Value(m_parameters.min_distance * unit),
+            Value(m_parameters.medium_limit * unit)};
+}
+
+template <typename T>
+void ImageProcessor::findObjectsOf() {
     // printFindInfo(zlimit, minDistance, minDots, maxObjects);
     auto i_use = Printer::ERROR::INFO_USING;
     auto i_info = Printer::ERROR::INFO;
@@ -131,11 +168,12 @@ void ImageProcessor::findObjects() {
     int x, y = 0;
     Stats stats = {visited, amount};
     uchar id = UCHAR_MAX;
+    const Limits<T> limits = limitsOf<T>();
 
     // Preinit
     cv::Mat output = cv::Mat((*image).rows, (*image).cols, CV_8U, double(0));
     Point current = Point(0, 0);
-    uchar val = 0;
+    T val = 0;
 
     m_log.start();
 
@@ -145,18 +183,18 @@ void ImageProcessor::findObjects() {
 
         // Skip undesired points
         current = Point(x, y);  //? remove this init?
-        val = (*image).at<uchar>(current);
+        val = (*image).at<T>(current);
         visited++;
-        if (val <= m_parameters.min_distance) continue;
+        if (val <= limits.min_distance) continue;
         if (m_objects.at<uchar>(current) != 0) continue;
 
         m_log.start();
         amount = 0;
         imageLeft = size - y * nCols + x;  // TODO
         if (m_parameters.recurse)
-            paint(current, output, id, stats);
+            paint(current, output, id, stats, limits);
         else
-            iterate(current, output, imageLeft, id, stats);
+            iterate(current, output, imageLeft, id, stats, limits);
 
         if (amount < m_parameters.min_area) {
             m_printer.log_message({w_smol, {amount, m_parameters.min_area}});
@@ -165,7 +203,7 @@ void ImageProcessor::findObjects() {
         }
 
         if (mask_mats.size() < m_parameters.max_objects)
-            mask_mats.push_back({output, amount});
+            mask_mats.push_back({output, amount, mean(*image, output)[0]});
         else {
             m_printer.log_message({w_limit, {m_parameters.max_objects}});
             m_log.drop();
@@ -193,10 +231,45 @@ void ImageProcessor::findObjects() {
     imwrite(m_out_path + "objects.png", m_objects);
 }
 
+void ImageProcessor::warpMasks(const cv::Mat &homography, cv::Size size) {
+    if (homography.empty()) return;
+
+    for (auto &mask : mask_mats) {
+        vector<vector<Point>> contours;
+        vector<Vec4i> hierarchy;
+        // Outer borders and holes, compressed to their corner points
+        findContours(mask.mat, contours, hierarchy, RETR_CCOMP,
+                     CHAIN_APPROX_SIMPLE);
+
+        for (auto &contour : contours) {
+            vector<Point2f> points(contour.begin(), contour.end());
+            perspectiveTransform(points, points, homography);
+            for (int i = 0; i < contour.size(); i++)
+                contour.at(i) = Point(cvRound(points.at(i).x),
+                                      cvRound(points.at(i).y));
+        }
+
+        cv::Mat warped = cv::Mat::zeros(size, CV_8U);
+        drawContours(warped, contours, -1, Scalar(UCHAR_MAX), FILLED,
+                     LINE_8, hierarchy);
+        mask.mat = warped;
+    }
+}
+
 void ImageProcessor::pruneMasks() { mask_mats.clear(); }
 
+void ImageProcessor::describeMasks() {
+    for (auto &mask : mask_mats) {
+        mask.bbox = boundingRect(mask.mat);
+        Moments m = moments(mask.mat, true);
+        if (m.m00 > 0)
+            mask.centroid = Point2f(m.m10 / m.m00, m.m01 / m.m00);
+    }
+}
+
+template <typename T>
 void ImageProcessor::iterate(Point start, cv::Mat &output, int imageLeft,
-                             uchar &id, Stats stats) {
+                             uchar &id, Stats stats, const Limits<T> &limits) {
     auto [visited, amount] = stats;
 
     output = cv::Mat((*image).rows, (*image).cols, CV_8U, double(0));
@@ -204,7 +277,7 @@ void ImageProcessor::iterate(Point start, cv::Mat &output, int imageLeft,
     output.at<uchar>(start) = id;
     Dirs dirs;
 
-    uchar previous_z = 0;
+    T previous_z = 0;
     Point point_to_check = start;
     PointDirs pd{point_to_check, dirs.toRIGHT};
     m_objects.at<uchar>(point_to_check) = id;
@@ -220,7 +293,7 @@ void ImageProcessor::iterate(Point start, cv::Mat &output, int imageLeft,
         pd = list.back();
         list.pop_back();
 
-        previous_z = (*image).at<uchar>(pd.coordinates);
+        previous_z = (*image).at<T>(pd.coordinates);
         mediumVal = (mediumVal * amount + previous_z) / (amount + 1);
         for (auto dir : pd.directions) {
             point_to_check = pd.coordinates;
@@ -233,17 +306,13 @@ void ImageProcessor::iterate(Point start, cv::Mat &output, int imageLeft,
                 point_to_check.y < 0)
                 continue;
             if (m_objects.at<uchar>(point_to_check) != 0) continue;
-            if ((*image).at<uchar>(point_to_check) <= m_parameters.min_distance)
-                continue;
-            if (abs((*image).at<uchar>(point_to_check) - previous_z) >
-                m_parameters.z_limit)
-                continue;
+            T z = (*image).at<T>(point_to_check);
+            if (z <= limits.min_distance) continue;
+            if (abs(z - previous_z) > limits.z_limit) continue;
 
             // Additional checks
             // medium check
-            if (abs((*image).at<uchar>(point_to_check) - mediumVal) >
-                m_parameters.medium_limit)
-                continue;
+            if (abs(z - mediumVal) > limits.medium_limit) continue;
 
             amount++;
             // TODO 1. Add area to objects later and do checks via output
@@ -258,34 +327,36 @@ void ImageProcessor::iterate(Point start, cv::Mat &output, int imageLeft,
     }
 }
 
+template <typename T>
 void ImageProcessor::paint(Point start, cv::Mat &output, uchar &id,
-                           Stats stats) {
+                           Stats stats, const Limits<T> &limits) {
     auto [visited, amount] = stats;
 
     output = cv::Mat((*image).rows, (*image).cols, CV_8U, double(0));
-    uchar start_z = (*image).at<uchar>(start);
+    T start_z = (*image).at<T>(start);
     double mediumVal = start_z;
 
-    walk(output, start_z, mediumVal, start.x, start.y, id, visited, amount);
+    walk(output, start_z, mediumVal, start.x, start.y, id, visited, amount,
+         limits);
 }
 
-bool ImageProcessor::walk(cv::Mat &output, uchar prev_z, double &mediumVal,
-                          int x, int y, uchar &id, int &visited, int &amount) {
+template <typename T>
+bool ImageProcessor::walk(cv::Mat &output, T prev_z, double &mediumVal, int x,
+                          int y, uchar &id, int &visited, int &amount,
+                          const Limits<T> &limits) {
     visited++;
     // Basic checks
     if (x >= (*image).cols || y >= (*image).rows || x < 0 || y < 0)
         return false;
     Point current = Point(x, y);
     if (m_objects.at<uchar>(current) != 0) return false;
-    if ((*image).at<uchar>(current) <= m_parameters.min_distance) return false;
-    if (abs((*image).at<uchar>(current) - prev_z) > m_parameters.z_limit)
-        return false;
+    T z = (*image).at<T>(current);
+    if (z <= limits.min_distance) return false;
+    if (abs(z - prev_z) > limits.z_limit) return false;
 
     // Additional checks
     // medium check
-    if (abs((*image).at<uchar>(current) - mediumVal) >
-        m_parameters.medium_limit)
-        return false;
+    if (abs(z - mediumVal) > limits.medium_limit) return false;
 
     m_objects.at<uchar>(current) = id;  // Painting the pixel
     output.at<uchar>(current) = id;     // Painting the pixel
@@ -293,9 +364,8 @@ bool ImageProcessor::walk(cv::Mat &output, uchar prev_z, double &mediumVal,
     mediumVal = (mediumVal * amount + prev_z) / (amount + 1);
     // recurse
     for (int i = 0; i < 4; i++) {
-        walk(output, (*image).at<uchar>(current), mediumVal,
-             current.x + directions[i][0], current.y + directions[i][1], id,
-             visited, amount);
+        walk(output, z, mediumVal, current.x + directions[i][0],
+             current.y + directions[i][1], id, visited, amount, limits);
     }
 
     return false;
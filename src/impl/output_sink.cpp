@@ -0,0 +1,78 @@
+#include "../headers/output_sink.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+OutputSink::Type OutputSink::parse(std::string name) {
+    if (name == "window") return WINDOW;
+    if (name == "files") return FILES;
+    if (name == "null") return NONE;
+    throw std::runtime_error("Unknown output sink: " + name);
+}
+
+std::unique_ptr<OutputSink> OutputSink::make(Type type,
+                                             std::string window_name,
+                                             std::string output_location) {
+    switch (type) {
+        case WINDOW:
+            return std::make_unique<HighGuiSink>(window_name);
+        case FILES:
+            return std::make_unique<FileSequenceSink>(output_location +
+                                                      "frames/");
+        default:
+            return std::make_unique<NullSink>();
+    }
+}
+
+void HighGuiSink::open() {
+    cv::namedWindow(m_window_name, cv::WindowFlags::WINDOW_NORMAL);
+    cv::setWindowProperty(m_window_name,
+                          cv::WindowPropertyFlags::WND_PROP_FULLSCREEN,
+                          cv::WindowFlags::WINDOW_FULLSCREEN);
+}
+
+void HighGuiSink::show(const cv::Mat &image) {
+    cv::imshow(m_window_name, image);
+    m_shown++;
+}
+
+void HighGuiSink::close() { cv::destroyWindow(m_window_name); }
+
+void FileSequenceSink::open() {
+    std::filesystem::create_directories(m_directory);
+}
+
+void FileSequenceSink::show(const cv::Mat &image) {
+    cv::Mat frame = image;
+    if (frame.depth() != CV_8U) frame.convertTo(frame, CV_8U);
+    if (!frame.isContinuous()) frame = frame.clone();
+
+    if (frame.size() != m_size || frame.channels() != m_channels) {
+        m_size = frame.size();
+        m_channels = frame.channels();
+        writeFormat();
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%06llu.raw",
+             (unsigned long long)m_shown);
+    std::string path = m_directory + name;
+    std::string partial = path + ".part";
+
+    std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(frame.data),
+               frame.total() * frame.elemSize());
+    file.close();
+    if (!file) throw std::runtime_error("Cannot write frame " + partial);
+    std::filesystem::rename(partial, path);
+
+    m_shown++;
+}
+
+void FileSequenceSink::writeFormat() {
+    std::ofstream format(m_directory + "format.txt", std::ios::trunc);
+    format << m_size.width << " " << m_size.height << " " << m_channels
+           << std::endl;
+}
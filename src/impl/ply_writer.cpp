@@ -0,0 +1,140 @@
+#include "../headers/ply_writer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little,
+              "PLY records are written in memory order");
+
+constexpr size_t VERTEX_BYTES = 3 * sizeof(float) + 3;
+constexpr size_t FACE_BYTES = 1 + 3 * sizeof(int32_t);
+constexpr size_t CHUNK_BYTES = 1 << 20;
+// Digits of the widest count
+constexpr size_t COUNT_DIGITS = 20;
+
+// Counts are written exactly, a comment pads the header to the length it
+// has with the widest counts, so the final header overwrites the first
+std::string header(uint64_t vertices, uint64_t faces) {
+    std::string vertex_count = std::to_string(vertices);
+    std::string face_count = std::to_string(faces);
+    std::string padding(
+        2 * COUNT_DIGITS - vertex_count.size() - face_count.size(), ' ');
+    return "ply\n"
+           "format binary_little_endian 1.0\n"
+           "comment " + padding + "\n"
+           "element vertex " + vertex_count + "\n"
+           "property float x\n"
+           "property float y\n"
+           "property float z\n"
+           "property uchar red\n"
+           "property uchar green\n"
+           "property uchar blue\n"
+           "element face " + face_count + "\n"
+           "property list uchar int vertex_indices\n"
+           "end_header\n";
+}
+
+char *packVertices(const cv::Vec4f *vertices, size_t count, char *out) {
+    for (size_t i = 0; i < count; i++, out += VERTEX_BYTES) {
+        std::memcpy(out, &vertices[i][0], 3 * sizeof(float));
+        // RGBA bytes, alpha is not written
+        std::memcpy(out + 3 * sizeof(float), &vertices[i][3], 3);
+    }
+    return out;
+}
+
+char *packFaces(const cv::Vec3i *faces, size_t count, char *out) {
+    for (size_t i = 0; i < count; i++, out += FACE_BYTES) {
+        out[0] = 3;
+        std::memcpy(out + 1, &faces[i][0], 3 * sizeof(int32_t));
+    }
+    return out;
+}
+
+// Packs records chunk by chunk into buffer and writes each chunk at once
+template <typename T, typename Pack>
+void writeChunked(std::ofstream &file, std::vector<char> &buffer,
+                  const T *records, size_t count, size_t record_bytes,
+                  Pack pack) {
+    size_t per_chunk = CHUNK_BYTES / record_bytes;
+    buffer.resize(std::min(count, per_chunk) * record_bytes);
+    for (size_t done = 0; done < count; done += per_chunk) {
+        size_t amount = std::min(per_chunk, count - done);
+        char *end = pack(records + done, amount, buffer.data());
+        file.write(buffer.data(), end - buffer.data());
+    }
+}
+
+}  // namespace
+
+PlyWriter::PlyWriter(std::string path)
+    : m_path(path), m_faces_path(path + ".faces") {
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    m_faces.open(m_faces_path, std::ios::binary | std::ios::trunc);
+    if (!m_file || !m_faces)
+        throw std::runtime_error("Cannot create PLY file " + path);
+
+    std::string placeholder = header(0, 0);
+    m_file.write(placeholder.data(), placeholder.size());
+}
+
+PlyWriter::~PlyWriter() {
+    try {
+        close();
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << " in method '~PlyWriter'\n";
+    }
+}
+
+void PlyWriter::writeVertices(const cv::Vec4f *vertices, size_t count) {
+    if (!m_file.is_open()) throw std::runtime_error("PLY file is closed");
+    writeChunked(m_file, m_buffer, vertices, count, VERTEX_BYTES,
+                 packVertices);
+    m_vertex_count += count;
+}
+
+void PlyWriter::writeFaces(const cv::Vec3i *faces, size_t count) {
+    if (!m_file.is_open()) throw std::runtime_error("PLY file is closed");
+    writeChunked(m_faces, m_buffer, faces, count, FACE_BYTES, packFaces);
+    m_face_count += count;
+}
+
+void PlyWriter::close() {
+    if (!m_file.is_open()) return;
+
+    m_faces.close();
+    std::ifstream faces(m_faces_path, std::ios::binary);
+    m_buffer.resize(CHUNK_BYTES);
+    while (faces.read(m_buffer.data(), m_buffer.size()) || faces.gcount() > 0)
+        m_file.write(m_buffer.data(), faces.gcount());
+    faces.close();
+    std::remove(m_faces_path.c_str());
+
+    std::string final_header = header(m_vertex_count, m_face_count);
+    m_file.seekp(0);
+    m_file.write(final_header.data(), final_header.size());
+    m_file.close();
+    if (m_file.fail())
+        throw std::runtime_error("Writing PLY file " + m_path + " failed");
+}
+
+void PlyWriter::write(std::string path, const Mesh &mesh) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) throw std::runtime_error("Cannot create PLY file " + path);
+
+    std::string text = header(mesh.vertices.size(), mesh.triangles.size());
+    file.write(text.data(), text.size());
+
+    std::vector<char> buffer;
+    writeChunked(file, buffer, mesh.vertices.data(), mesh.vertices.size(),
+                 VERTEX_BYTES, packVertices);
+    writeChunked(file, buffer, mesh.triangles.data(), mesh.triangles.size(),
+                 FACE_BYTES, packFaces);
+    if (!file) throw std::runtime_error("Writing PLY file " + path + " failed");
+}
@@ -0,0 +1,244 @@
+#include "../headers/point_cloud.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// BGRA in memory to RGBA in memory, on little endian words
+inline uint32_t bgraToRgba(uint32_t bgra) {
+    return (bgra & 0xff00ff00u) | ((bgra & 0xffu) << 16) |
+           ((bgra >> 16) & 0xffu);
+}
+
+inline uint32_t bgrToRgba(const uchar *bgr) {
+    return uint32_t(bgr[2]) | uint32_t(bgr[1]) << 8 | uint32_t(bgr[0]) << 16 |
+           0xff000000u;
+}
+
+// Branch-free body so the row loop vectorizes
+template <int CHANNELS>
+void projectRows(const cv::Mat &depth, const cv::Mat &color, cv::Mat &cloud,
+                 const float *ray_x, const float *ray_y, int begin, int end) {
+    const int width = depth.cols;
+    for (int y = begin; y < end; y++) {
+        const float *source = depth.ptr<float>(y);
+        float *target = cloud.ptr<float>(y);
+        const float ray = ray_y[y];
+
+        for (int x = 0; x < width; x++) {
+            float value = source[x];
+            target[4 * x + 0] = ray_x[x] * value;
+            target[4 * x + 1] = ray * value;
+            target[4 * x + 2] = -value;
+        }
+
+        if (CHANNELS == 4) {
+            const uint32_t *pixels = color.ptr<uint32_t>(y);
+            for (int x = 0; x < width; x++)
+                target[4 * x + 3] = std::bit_cast<float>(bgraToRgba(pixels[x]));
+        } else if (CHANNELS == 3) {
+            const uchar *pixels = color.ptr<uchar>(y);
+            for (int x = 0; x < width; x++)
+                target[4 * x + 3] =
+                    std::bit_cast<float>(bgrToRgba(pixels + 3 * x));
+        } else {
+            for (int x = 0; x < width; x++) target[4 * x + 3] = 0;
+        }
+    }
+}
+
+// Bits per axis of a voxel key, the all ones key stays free for EMPTY
+constexpr int KEY_BITS = 21;
+constexpr int64_t KEY_OFFSET = int64_t(1) << (KEY_BITS - 1);
+
+inline uint64_t voxelKey(float x, float y, float z, float scale) {
+    uint64_t key = 0;
+    for (float value : {x, y, z}) {
+        // Compared before the cast, out of range floats must not reach it
+        float cell = std::floor(value * scale);
+        if (!(std::abs(cell) < float(KEY_OFFSET))) return VoxelGrid::EMPTY;
+        key = key << KEY_BITS | uint64_t(int64_t(cell) + KEY_OFFSET);
+    }
+    return key;
+}
+
+inline size_t slotOf(uint64_t key, int bits) {
+    return (key * 0x9e3779b97f4a7c15ull) >> (64 - bits);
+}
+
+}  // namespace
+
+BackProjector::BackProjector(CameraIntrinsics intrinsics, cv::Size size) {
+    setIntrinsics(intrinsics, size);
+}
+
+void BackProjector::setIntrinsics(CameraIntrinsics intrinsics, cv::Size size) {
+    if (intrinsics == m_intrinsics && size == m_size) return;
+    if (!intrinsics.valid())
+        throw std::runtime_error("Back projection needs focal lengths");
+
+    m_ray_x.resize(size.width);
+    for (int x = 0; x < size.width; x++)
+        m_ray_x[x] = (x - intrinsics.cx) / intrinsics.fx;
+    m_ray_y.resize(size.height);
+    for (int y = 0; y < size.height; y++)
+        m_ray_y[y] = -(y - intrinsics.cy) / intrinsics.fy;
+
+    m_intrinsics = intrinsics;
+    m_size = size;
+}
+
+void BackProjector::project(const cv::Mat &depth, const cv::Mat &color,
+                            cv::Mat &cloud) const {
+    if (depth.type() != CV_32FC1)
+        throw std::runtime_error("Metric depth has to be CV_32FC1");
+    if (depth.size() != m_size)
+        throw std::runtime_error("Depth does not match the intrinsics size");
+    int channels = color.empty() ? 0 : color.channels();
+    if (channels != 0 && (color.depth() != CV_8U || channels < 3 ||
+                          color.size() != depth.size()))
+        throw std::runtime_error("Colour has to be BGR or BGRA of depth size");
+
+    cloud.create(depth.size(), CV_32FC4);
+    const float *ray_x = m_ray_x.data();
+    const float *ray_y = m_ray_y.data();
+    cv::parallel_for_(cv::Range(0, depth.rows), [&](const cv::Range &rows) {
+        if (channels == 4)
+            projectRows<4>(depth, color, cloud, ray_x, ray_y, rows.start,
+                           rows.end);
+        else if (channels == 3)
+            projectRows<3>(depth, color, cloud, ray_x, ray_y, rows.start,
+                           rows.end);
+        else
+            projectRows<0>(depth, color, cloud, ray_x, ray_y, rows.start,
+                           rows.end);
+    });
+}
+
+void filterFinite(const cv::Mat &cloud, PointCloud &points) {
+    if (cloud.type() != CV_32FC4)
+        throw std::runtime_error("Point cloud has to be CV_32FC4");
+
+    const int rows = cloud.rows;
+    const int cols = cloud.cols;
+    points.resize(size_t(rows) * cols);
+    std::vector<size_t> counts(rows);
+
+    // Every row compacts into its own stretch of the output, branch free:
+    // each point is stored and the position only advances past finite ones
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const float *source = cloud.ptr<float>(y);
+            size_t start = size_t(y) * cols;
+            float *xs = points.x.data() + start;
+            float *ys = points.y.data() + start;
+            float *zs = points.z.data() + start;
+            uint32_t *colors = points.rgba.data() + start;
+            size_t count = 0;
+            for (int x = 0; x < cols; x++) {
+                const float *point = source + 4 * x;
+                xs[count] = point[0];
+                ys[count] = point[1];
+                zs[count] = point[2];
+                colors[count] = std::bit_cast<uint32_t>(point[3]);
+                count += std::isfinite(point[0]) & std::isfinite(point[1]) &
+                         std::isfinite(point[2]);
+            }
+            counts[y] = count;
+        }
+    });
+
+    // Rows only move towards the front, each ends before the next starts
+    size_t total = 0;
+    for (int y = 0; y < rows; y++) {
+        size_t start = size_t(y) * cols;
+        if (total != start) {
+            std::memmove(&points.x[total], &points.x[start],
+                         counts[y] * sizeof(float));
+            std::memmove(&points.y[total], &points.y[start],
+                         counts[y] * sizeof(float));
+            std::memmove(&points.z[total], &points.z[start],
+                         counts[y] * sizeof(float));
+            std::memmove(&points.rgba[total], &points.rgba[start],
+                         counts[y] * sizeof(uint32_t));
+        }
+        total += counts[y];
+    }
+    points.resize(total);
+}
+
+VoxelGrid::VoxelGrid(float size) { setSize(size); }
+
+void VoxelGrid::setSize(float size) {
+    if (!(size > 0)) throw std::runtime_error("Voxels need a positive size");
+    m_size = size;
+}
+
+void VoxelGrid::downsample(const PointCloud &points, PointCloud &out) {
+    const size_t count = points.size();
+    const float scale = 1.0f / m_size;
+
+    m_keys.resize(count);
+    cv::parallel_for_(cv::Range(0, int(count)), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++)
+            m_keys[i] = std::isfinite(points.x[i]) &&
+                                std::isfinite(points.y[i]) &&
+                                std::isfinite(points.z[i])
+                            ? voxelKey(points.x[i], points.y[i],
+                                       points.z[i], scale)
+                            : EMPTY;
+    });
+
+    // At most half full, so probe sequences stay short
+    int bits = 4;
+    while ((size_t(1) << bits) < 2 * count) bits++;
+    m_table.assign(size_t(1) << bits, EMPTY);
+    m_voxels.resize(m_table.size());
+    m_sums.clear();
+
+    const size_t mask = m_table.size() - 1;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t key = m_keys[i];
+        if (key == EMPTY) continue;
+
+        size_t slot = slotOf(key, bits);
+        while (m_table[slot] != EMPTY && m_table[slot] != key)
+            slot = (slot + 1) & mask;
+        if (m_table[slot] == EMPTY) {
+            m_table[slot] = key;
+            m_voxels[slot] = m_sums.size();
+            m_sums.push_back({});
+        }
+
+        Sum &sum = m_sums[m_voxels[slot]];
+        uint32_t color = points.rgba[i];
+        sum.x += points.x[i];
+        sum.y += points.y[i];
+        sum.z += points.z[i];
+        sum.r += color & 0xff;
+        sum.g += color >> 8 & 0xff;
+        sum.b += color >> 16 & 0xff;
+        sum.count++;
+    }
+
+    out.resize(m_sums.size());
+    cv::parallel_for_(
+        cv::Range(0, int(m_sums.size())), [&](const cv::Range &range) {
+            for (int i = range.start; i < range.end; i++) {
+                const Sum &sum = m_sums[i];
+                double inverse = 1.0 / sum.count;
+                out.x[i] = float(sum.x * inverse);
+                out.y[i] = float(sum.y * inverse);
+                out.z[i] = float(sum.z * inverse);
+                auto mean = [&](uint64_t total) {
+                    return uint32_t((total + sum.count / 2) / sum.count);
+                };
+                out.rgba[i] = mean(sum.r) | mean(sum.g) << 8 |
+                              mean(sum.b) << 16 | 0xff000000u;
+            }
+        });
+}
@@ -0,0 +1,70 @@
+#include "../headers/quality.hpp"
+
+#include <algorithm>
+
+QualityController::QualityController(Printer printer,
+                                     std::vector<QualityLevel> ladder,
+                                     int target_ms)
+    : m_printer(printer), m_ladder(ladder), m_target(target_ms * 1000) {
+    if (m_ladder.empty()) m_ladder.push_back(QualityLevel());
+}
+
+void QualityController::setLadder(std::vector<QualityLevel> ladder,
+                                  int target_ms) {
+    if (ladder.empty()) ladder.push_back(QualityLevel());
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ladder = ladder;
+    m_target = std::chrono::microseconds(target_ms * 1000);
+    m_level = m_target.count() <= 0
+                  ? 0
+                  : std::min<int>(m_level, m_ladder.size() - 1);
+    m_average = 0;
+    m_over = 0;
+    m_under = 0;
+}
+
+void QualityController::observe(std::chrono::microseconds frame_time) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_target.count() <= 0) return;
+
+    double time = frame_time.count();
+    m_average =
+        m_average == 0 ? time : m_average + SMOOTHING * (time - m_average);
+
+    if (m_average > m_target.count()) {
+        m_under = 0;
+        if (++m_over >= DOWN_AFTER) step(+1);
+    } else if (m_average < HEADROOM * m_target.count()) {
+        m_over = 0;
+        if (++m_under >= UP_AFTER) step(-1);
+    } else {
+        m_over = 0;
+        m_under = 0;
+    }
+}
+
+QualityLevel QualityController::level() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_ladder.at(m_level);
+}
+
+void QualityController::step(int direction) {
+    m_over = 0;
+    m_under = 0;
+    double average = m_average;
+    m_average = 0;  // measure the new level from scratch
+
+    int next = m_level + direction;
+    if (next < 0 || next >= m_ladder.size()) return;
+    m_level = next;
+
+    auto [scale, erodil_passes, segment_every, simple_templates] =
+        m_ladder.at(next);
+    m_printer.log_message({Printer::INFO_QUALITY,
+                           {next, int(average / 1000),
+                            int(m_target.count() / 1000), int(scale * 100),
+                            erodil_passes, segment_every,
+                            simple_templates ? 1 : 0},
+                           direction > 0 ? "down" : "up",
+                           Printer::DEBUG_LVL::PRODUCTION});
+}
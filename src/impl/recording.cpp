@@ -0,0 +1,434 @@
+#include "../headers/recording.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace {
+
+// XOR delta as (zero run, literal count, literals) tokens. Short zero runs
+// stay inside the literals so static scenes do not explode into tokens.
+constexpr size_t MIN_ZERO_RUN = 8;
+
+void appendCount(std::vector<uint8_t> &out, uint32_t value) {
+    uint8_t bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+void encodeRle(const std::vector<uint8_t> &delta, std::vector<uint8_t> &out) {
+    out.clear();
+    size_t size = delta.size();
+    size_t i = 0;
+    while (i < size) {
+        size_t literals = i;
+        while (literals < size && delta[literals] == 0) literals++;
+
+        size_t end = literals;
+        while (end < size) {
+            if (delta[end] != 0) {
+                end++;
+                continue;
+            }
+            size_t run = end;
+            while (run < size && delta[run] == 0 && run - end < MIN_ZERO_RUN)
+                run++;
+            if (run - end >= MIN_ZERO_RUN || run == size) break;
+            end = run;
+        }
+
+        appendCount(out, literals - i);
+        appendCount(out, end - literals);
+        out.insert(out.end(), delta.begin() + literals, delta.begin() + end);
+        i = end;
+    }
+}
+
+void applyRle(const uint8_t *data, size_t size, uint8_t *target,
+              size_t target_size) {
+    const uint8_t *end = data + size;
+    size_t position = 0;
+    while (data + 2 * sizeof(uint32_t) <= end) {
+        uint32_t zeros, literals;
+        std::memcpy(&zeros, data, sizeof(zeros));
+        std::memcpy(&literals, data + sizeof(zeros), sizeof(literals));
+        data += 2 * sizeof(uint32_t);
+
+        position += zeros;
+        if (position + literals > target_size || data + literals > end)
+            throw std::runtime_error("Corrupted delta frame in recording");
+        for (uint32_t i = 0; i < literals; i++) target[position + i] ^= data[i];
+        position += literals;
+        data += literals;
+    }
+}
+
+void requireLz4() {
+#ifndef WITH_LZ4
+    throw std::runtime_error("Recording uses LZ4, rebuild with WITH_LZ4");
+#endif
+}
+
+}  // namespace
+
+RecordingWriter::RecordingWriter(std::string path, Compression compression)
+    : m_path(path), m_compression(compression) {
+    if (compression == LZ4) requireLz4();
+
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) throw std::runtime_error("Cannot create recording " + path);
+
+    std::memcpy(m_header.magic, RecordingFormat::MAGIC, sizeof(m_header.magic));
+    m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+    pad();
+}
+
+RecordingWriter::~RecordingWriter() { close(); }
+
+RecordingWriter::Compression RecordingWriter::bestCompression() {
+#ifdef WITH_LZ4
+    return LZ4;
+#else
+    return DELTA;
+#endif
+}
+
+void RecordingWriter::addCalibration(uint32_t id, const cv::Mat &homography) {
+    RecordingFormat::Calibration calibration{
+        id, 0, {1, 0, 0, 0, 1, 0, 0, 0, 1}};
+    if (homography.rows == 3 && homography.cols == 3) {
+        cv::Mat values;
+        homography.convertTo(values, CV_64F);
+        for (int i = 0; i < 9; i++)
+            calibration.homography[i] = values.at<double>(i / 3, i % 3);
+    }
+    m_calibrations.push_back(calibration);
+}
+
+void RecordingWriter::write(const cv::Mat &plane, int64_t timestamp_ns,
+                            uint32_t calibration_id) {
+    if (!m_file.is_open()) throw std::runtime_error("Recording is closed");
+    if (plane.type() != CV_8UC1 && plane.type() != CV_16UC1)
+        throw std::runtime_error("Only 8 or 16 bit depth planes are recorded");
+
+    if (m_index.empty()) {
+        m_header.width = plane.cols;
+        m_header.height = plane.rows;
+        m_header.depth_bits = plane.type() == CV_16UC1 ? 16 : 8;
+    } else if (plane.cols != m_header.width || plane.rows != m_header.height ||
+               plane.elemSize() * 8 != m_header.depth_bits) {
+        throw std::runtime_error("Frame does not match the recording format");
+    }
+
+    cv::Mat data = plane.isContinuous() ? plane : plane.clone();
+    size_t bytes = data.total() * data.elemSize();
+    uint32_t index = m_index.size();
+
+    bool keyframe = m_compression == NONE || m_previous.empty() ||
+                    index - m_keyframe >= KEYFRAME_INTERVAL;
+
+    RecordingFormat::IndexEntry entry{};
+    entry.offset = m_file.tellp();
+    entry.timestamp_ns = timestamp_ns;
+    entry.calibration_id = calibration_id;
+
+    const uint8_t *payload = data.data;
+    size_t payload_size = bytes;
+    entry.encoding = RecordingFormat::RAW;
+
+    if (!keyframe) {
+        m_delta.resize(bytes);
+        const uint8_t *previous = m_previous.data;
+        for (size_t i = 0; i < bytes; i++)
+            m_delta[i] = data.data[i] ^ previous[i];
+    }
+
+    if (m_compression == LZ4) {
+#ifdef WITH_LZ4
+        const char *input =
+            keyframe ? reinterpret_cast<const char *>(data.data)
+                     : reinterpret_cast<const char *>(m_delta.data());
+        m_encoded.resize(LZ4_compressBound(bytes));
+        int size = LZ4_compress_default(
+            input, reinterpret_cast<char *>(m_encoded.data()), bytes,
+            m_encoded.size());
+        if (size > 0) {
+            payload = m_encoded.data();
+            payload_size = size;
+            entry.encoding = keyframe ? RecordingFormat::LZ4
+                                      : RecordingFormat::DELTA_LZ4;
+        }
+#endif
+    } else if (!keyframe) {
+        encodeRle(m_delta, m_encoded);
+        payload = m_encoded.data();
+        payload_size = m_encoded.size();
+        entry.encoding = RecordingFormat::DELTA_RLE;
+    }
+
+    // Noisy frames do not compress, keep them raw and start a new chain
+    if (payload_size >= bytes) {
+        payload = data.data;
+        payload_size = bytes;
+        entry.encoding = RecordingFormat::RAW;
+    }
+    if (entry.encoding == RecordingFormat::RAW ||
+        entry.encoding == RecordingFormat::LZ4)
+        m_keyframe = index;
+    entry.keyframe = m_keyframe;
+    entry.size = payload_size;
+
+    m_file.write(reinterpret_cast<const char *>(payload), payload_size);
+    pad();
+    if (!m_file) throw std::runtime_error("Writing recording failed");
+
+    data.copyTo(m_previous);
+    m_index.push_back(entry);
+    m_raw_bytes += bytes;
+    m_written_bytes += payload_size;
+}
+
+void RecordingWriter::close() {
+    if (!m_file.is_open()) return;
+
+    m_header.frame_count = m_index.size();
+    m_header.index_offset = m_file.tellp();
+    m_file.write(reinterpret_cast<const char *>(m_index.data()),
+                 m_index.size() * sizeof(RecordingFormat::IndexEntry));
+    pad();
+
+    m_header.calibration_count = m_calibrations.size();
+    m_header.calibration_offset = m_file.tellp();
+    m_file.write(reinterpret_cast<const char *>(m_calibrations.data()),
+                 m_calibrations.size() * sizeof(RecordingFormat::Calibration));
+
+    m_file.seekp(0);
+    m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+    m_file.close();
+}
+
+void RecordingWriter::pad() {
+    uint64_t position = m_file.tellp();
+    uint64_t padding = (RecordingFormat::PAGE_ALIGN -
+                        position % RecordingFormat::PAGE_ALIGN) %
+                       RecordingFormat::PAGE_ALIGN;
+    static const char zeros[RecordingFormat::PAGE_ALIGN] = {};
+    m_file.write(zeros, padding);
+}
+
+RecordingReader::RecordingReader(std::string path) {
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) throw std::runtime_error("Cannot open recording " + path);
+
+    struct stat status;
+    if (fstat(m_fd, &status) != 0 || status.st_size < sizeof(m_header)) {
+        ::close(m_fd);
+        throw std::runtime_error("Not a recording: " + path);
+    }
+    m_size = status.st_size;
+
+    void *mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        ::close(m_fd);
+        throw std::runtime_error("Cannot map recording " + path);
+    }
+    m_data = static_cast<const uint8_t *>(mapping);
+    madvise(mapping, m_size, MADV_SEQUENTIAL);
+
+    std::memcpy(&m_header, m_data, sizeof(m_header));
+    uint64_t index_end =
+        m_header.index_offset +
+        m_header.frame_count * sizeof(RecordingFormat::IndexEntry);
+    uint64_t calibration_end =
+        m_header.calibration_offset +
+        m_header.calibration_count * sizeof(RecordingFormat::Calibration);
+
+    std::string problem;
+    if (std::memcmp(m_header.magic, RecordingFormat::MAGIC,
+                    sizeof(m_header.magic)) != 0)
+        problem = "Not a recording: ";
+    else if (m_header.version != RecordingFormat::VERSION)
+        problem = "Unsupported recording version: ";
+    else if (m_header.depth_bits != 8 && m_header.depth_bits != 16)
+        problem = "Unsupported depth format: ";
+    else if (m_header.frame_count == 0 || index_end > m_size ||
+             calibration_end > m_size)
+        problem = "Recording was not closed properly: ";
+
+    if (!problem.empty()) {
+        munmap(mapping, m_size);
+        ::close(m_fd);
+        throw std::runtime_error(problem + path);
+    }
+
+    m_index = reinterpret_cast<const RecordingFormat::IndexEntry *>(
+        m_data + m_header.index_offset);
+    m_calibrations = reinterpret_cast<const RecordingFormat::Calibration *>(
+        m_data + m_header.calibration_offset);
+}
+
+RecordingReader::~RecordingReader() {
+    munmap(const_cast<uint8_t *>(m_data), m_size);
+    ::close(m_fd);
+}
+
+cv::Size RecordingReader::size() const {
+    return cv::Size(m_header.width, m_header.height);
+}
+
+int RecordingReader::type() const {
+    return m_header.depth_bits == 16 ? CV_16UC1 : CV_8UC1;
+}
+
+const RecordingFormat::IndexEntry &RecordingReader::entry(size_t index) const {
+    if (index >= m_header.frame_count)
+        throw std::out_of_range("Frame is not in the recording");
+    const auto &entry = m_index[index];
+    if (entry.offset + entry.size > m_size || entry.keyframe > index)
+        throw std::runtime_error("Corrupted recording index");
+    return entry;
+}
+
+cv::Mat RecordingReader::frame(size_t index) {
+    const auto &frame_entry = entry(index);
+    if (frame_entry.encoding == RecordingFormat::RAW) {
+        // Read-only mapping, writing through the view faults
+        return cv::Mat(size(), type(),
+                       const_cast<uint8_t *>(m_data + frame_entry.offset));
+    }
+    decode(index, m_decoded);
+    return m_decoded;
+}
+
+cv::Mat RecordingReader::homography(uint32_t calibration_id) const {
+    for (size_t i = 0; i < m_header.calibration_count; i++) {
+        if (m_calibrations[i].id != calibration_id) continue;
+        return cv::Mat(3, 3, CV_64F,
+                       const_cast<double *>(m_calibrations[i].homography))
+            .clone();
+    }
+    return cv::Mat::eye(3, 3, CV_64F);
+}
+
+void RecordingReader::decode(size_t index, cv::Mat &target) {
+    size_t first = entry(index).keyframe;
+    // Sequential replay continues the chain instead of restarting it
+    if (m_decoded_index >= int64_t(first) &&
+        m_decoded_index <= int64_t(index) && !target.empty())
+        first = m_decoded_index + 1;
+    else
+        target.create(size(), type());
+
+    size_t bytes = target.total() * target.elemSize();
+    for (size_t i = first; i <= index; i++) {
+        const auto &frame_entry = entry(i);
+        const uint8_t *payload = m_data + frame_entry.offset;
+
+        switch (frame_entry.encoding) {
+            case RecordingFormat::RAW:
+                if (frame_entry.size != bytes)
+                    throw std::runtime_error(
+                        "Corrupted raw frame in recording");
+                std::memcpy(target.data, payload, bytes);
+                break;
+            case RecordingFormat::DELTA_RLE:
+                applyRle(payload, frame_entry.size, target.data, bytes);
+                break;
+            case RecordingFormat::LZ4:
+            case RecordingFormat::DELTA_LZ4: {
+                requireLz4();
+#ifdef WITH_LZ4
+                bool delta = frame_entry.encoding == RecordingFormat::DELTA_LZ4;
+                if (delta) m_scratch.resize(bytes);
+                char *output =
+                    delta ? reinterpret_cast<char *>(m_scratch.data())
+                          : reinterpret_cast<char *>(target.data);
+                int size = LZ4_decompress_safe(
+                    reinterpret_cast<const char *>(payload), output,
+                    frame_entry.size, bytes);
+                if (size != bytes)
+                    throw std::runtime_error(
+                        "Corrupted LZ4 frame in recording");
+                if (delta)
+                    for (size_t j = 0; j < bytes; j++)
+                        target.data[j] ^= m_scratch[j];
+#endif
+            } break;
+            default:
+                throw std::runtime_error("Unknown frame encoding in recording");
+        }
+        m_decoded_index = i;
+    }
+}
+
+Recorder::Recorder(Printer printer, std::string path,
+                   RecordingWriter::Compression compression, size_t capacity)
+    : m_printer(printer),
+      m_path(path),
+      m_writer(path, compression),
+      m_queue(capacity, BoundedQueue<Item>::LATEST),
+      m_thread(&Recorder::run, this) {}
+
+Recorder::~Recorder() { stop(); }
+
+void Recorder::push(cv::Mat depth, FrameTimestamps::clock::time_point captured,
+                    uint32_t calibration_id, cv::Mat homography,
+                    const DepthQuantizer &quantizer) {
+    int64_t timestamp =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            captured.time_since_epoch())
+            .count();
+    m_queue.push({depth, timestamp, calibration_id, homography, quantizer});
+}
+
+void Recorder::stop() {
+    if (!m_thread.joinable()) return;
+    m_queue.close();
+    m_thread.join();
+    m_writer.close();
+
+    int ratio = m_writer.rawBytes() == 0
+                    ? 0
+                    : int(m_writer.writtenBytes() * 100 / m_writer.rawBytes());
+    m_printer.log_message({Printer::INFO_RECORDING,
+                           {int(m_writer.frameCount()), int(m_queue.dropped()),
+                            ratio},
+                           m_path,
+                           Printer::DEBUG_LVL::PRODUCTION});
+}
+
+void Recorder::run() {
+    Item item;
+    while (m_queue.pop(item)) {
+        try {
+            if (item.calibration_id != m_last_calibration) {
+                m_writer.addCalibration(item.calibration_id, item.homography);
+                m_last_calibration = item.calibration_id;
+            }
+
+            // The rendered depth view repeats the value in every channel
+            cv::Mat plane = item.depth;
+            if (plane.channels() == 4)
+                cvtColor(plane, plane, cv::COLOR_BGRA2GRAY);
+            if (plane.channels() == 3)
+                cvtColor(plane, plane, cv::COLOR_BGR2GRAY);
+            // Recordings hold integer planes only
+            if (plane.depth() == CV_32F) {
+                cv::Mat quantized;
+                item.quantizer.toInteger(plane, 16, quantized);
+                plane = quantized;
+            }
+            m_writer.write(plane, item.timestamp_ns, item.calibration_id);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << " in method 'Recorder::run'\n";
+        }
+    }
+}
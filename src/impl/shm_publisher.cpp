@@ -0,0 +1,127 @@
+#include "../headers/shm_publisher.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+ShmPublisher::ShmPublisher(std::string name, cv::Size max_size, int channels,
+                           uint32_t max_objects, uint32_t slots)
+    : m_name(name) {
+    if (slots < 2) throw std::runtime_error("Shared memory ring needs 2 slots");
+
+    size_t slot_size = ShmRing::slotSize(max_objects, max_size.width,
+                                         max_size.height, channels);
+    m_size = ShmRing::totalSize(slots, slot_size);
+
+    // A stale ring of an earlier run may have another layout
+    shm_unlink(("/" + name).c_str());
+    m_fd = shm_open(("/" + name).c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (m_fd < 0)
+        throw std::runtime_error("Cannot create shared memory " + name);
+
+    void *data = MAP_FAILED;
+    if (ftruncate(m_fd, m_size) == 0)
+        data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd,
+                    0);
+    if (data == MAP_FAILED) {
+        close(m_fd);
+        shm_unlink(("/" + name).c_str());
+        throw std::runtime_error("Cannot map shared memory " + name);
+    }
+    m_data = static_cast<uint8_t *>(data);
+
+    // ftruncate zeroed everything, slots start with even sequences
+    for (uint32_t i = 0; i < slots; i++)
+        new (m_data + sizeof(ShmRing::Header) + i * slot_size)
+            ShmRing::SlotHeader{};
+
+    m_header = new (m_data) ShmRing::Header{};
+    m_header->version = ShmRing::VERSION;
+    m_header->slot_count = slots;
+    m_header->max_objects = max_objects;
+    m_header->max_width = max_size.width;
+    m_header->max_height = max_size.height;
+    m_header->channels = channels;
+    m_header->slot_size = slot_size;
+    m_header->published.store(0, std::memory_order_relaxed);
+    m_header->retired.store(0, std::memory_order_relaxed);
+    // Readers check the magic first, it goes in last
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(m_header->magic, ShmRing::MAGIC, sizeof(ShmRing::MAGIC));
+}
+
+ShmPublisher::~ShmPublisher() {
+    m_header->retired.store(1, std::memory_order_release);
+    munmap(m_data, m_size);
+    close(m_fd);
+    shm_unlink(("/" + m_name).c_str());
+}
+
+uint8_t *ShmPublisher::slot(uint64_t index) {
+    return m_data + sizeof(ShmRing::Header) +
+           (index % m_header->slot_count) * m_header->slot_size;
+}
+
+bool ShmPublisher::fits(const cv::Mat &image) const {
+    return image.empty() || (image.depth() == CV_8U &&
+                             image.channels() == int(m_header->channels) &&
+                             image.cols <= int(m_header->max_width) &&
+                             image.rows <= int(m_header->max_height));
+}
+
+bool ShmPublisher::publish(
+    uint64_t frame_id, FrameTimestamps::clock::time_point captured,
+    const cv::Mat &image,
+    const std::vector<ImageProcessor::MatWithInfo> &objects) {
+    if (!fits(image)) return false;
+
+    uint8_t *base = slot(m_published);
+    auto header = reinterpret_cast<ShmRing::SlotHeader *>(base);
+    auto infos = reinterpret_cast<ShmRing::ObjectInfo *>(
+        base + ShmRing::objectsOffset());
+    uint8_t *pixels = base + ShmRing::pixelsOffset(m_header->max_objects);
+
+    // Odd while writing
+    uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    header->published = m_published + 1;
+    header->frame_id = frame_id;
+    header->captured_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              captured.time_since_epoch())
+                              .count();
+    header->published_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            FrameTimestamps::clock::now().time_since_epoch())
+            .count();
+    header->width = image.cols;
+    header->height = image.rows;
+
+    uint32_t count = std::min<size_t>(objects.size(), m_header->max_objects);
+    for (uint32_t i = 0; i < count; i++) {
+        const auto &object = objects.at(i);
+        infos[i] = {i + 1,
+                    uint32_t(object.area),
+                    object.bbox.x,
+                    object.bbox.y,
+                    object.bbox.width,
+                    object.bbox.height,
+                    object.centroid.x,
+                    object.centroid.y,
+                    float(object.mean_depth),
+                    0};
+    }
+    header->object_count = count;
+
+    size_t row = size_t(image.cols) * image.elemSize();
+    if (image.isContinuous())
+        std::memcpy(pixels, image.data, row * image.rows);
+    else
+        for (int y = 0; y < image.rows; y++)
+            std::memcpy(pixels + y * row, image.ptr(y), row);
+
+    header->sequence.store(sequence + 2, std::memory_order_release);
+    m_header->published.store(++m_published, std::memory_order_release);
+    return true;
+}
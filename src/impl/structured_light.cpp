@@ -0,0 +1,162 @@
+#include "../headers/structured_light.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+GrayCodePattern::GrayCodePattern(cv::Size projector)
+    : GrayCodePattern(projector, Parameters()) {}
+
+GrayCodePattern::GrayCodePattern(cv::Size projector, Parameters parameters)
+    : m_projector(projector),
+      m_parameters(parameters),
+      m_bits_x(bitsFor(projector.width)),
+      m_bits_y(bitsFor(projector.height)) {}
+
+int GrayCodePattern::bitsFor(int size) {
+    int bits = 1;
+    while ((1 << bits) < size) bits++;
+    return bits;
+}
+
+cv::Mat GrayCodePattern::pattern(int index) const {
+    if (index < 0 || index >= count())
+        throw std::out_of_range("No such Gray code pattern");
+    if (index < 2)
+        return cv::Mat(m_projector, CV_8U, cv::Scalar(index == 0 ? 255 : 0));
+
+    int bit = (index - 2) / 2;
+    bool inverse = (index - 2) % 2 == 1;
+    bool columns = bit < m_bits_x;
+    int bits = columns ? m_bits_x : m_bits_y;
+    int shift = bits - 1 - (columns ? bit : bit - m_bits_x);
+
+    // One line of stripes, repeated over the other axis
+    int length = columns ? m_projector.width : m_projector.height;
+    cv::Mat line(1, length, CV_8U);
+    for (int i = 0; i < length; i++) {
+        bool set = ((i ^ (i >> 1)) >> shift) & 1;
+        line.at<uchar>(i) = set != inverse ? 255 : 0;
+    }
+
+    cv::Mat image;
+    if (columns)
+        cv::repeat(line, m_projector.height, 1, image);
+    else
+        cv::repeat(line.t(), 1, m_projector.width, image);
+    return image;
+}
+
+cv::Mat GrayCodePattern::decode(const std::vector<cv::Mat> &captures) const {
+    if (int(captures.size()) != count())
+        throw std::runtime_error("Gray code needs " + std::to_string(count()) +
+                                 " captures");
+
+    cv::Mat valid;
+    cv::Mat contrast;
+    cv::subtract(captures.at(0), captures.at(1), contrast, cv::noArray(),
+                 CV_16S);
+    cv::compare(contrast, m_parameters.min_contrast, valid, cv::CMP_GE);
+
+    cv::Mat axes[2];
+    cv::Mat bit_set, difference, steady;
+    int index = 2;
+    for (int axis = 0; axis < 2; axis++) {
+        int bits = axis == 0 ? m_bits_x : m_bits_y;
+        cv::Mat value = cv::Mat::zeros(valid.size(), CV_32S);
+        cv::Mat binary = cv::Mat::zeros(valid.size(), CV_8U);
+
+        for (int bit = 0; bit < bits; bit++, index += 2) {
+            const cv::Mat &pattern = captures.at(index);
+            const cv::Mat &inverse = captures.at(index + 1);
+
+            cv::compare(pattern, inverse, bit_set, cv::CMP_GT);
+            cv::absdiff(pattern, inverse, difference);
+            cv::compare(difference, m_parameters.min_bit_contrast, steady,
+                        cv::CMP_GE);
+            cv::bitwise_and(valid, steady, valid);
+
+            // Gray to binary: every binary bit is the xor of the gray bits
+            // down to it
+            cv::bitwise_xor(binary, bit_set, binary);
+            cv::add(value, value, value);
+            cv::add(value, 1, value, binary);
+        }
+
+        // Codes past the edge of a non power of two projector are noise
+        int size = axis == 0 ? m_projector.width : m_projector.height;
+        cv::Mat inside;
+        cv::compare(value, size, inside, cv::CMP_LT);
+        cv::bitwise_and(valid, inside, valid);
+
+        value.convertTo(axes[axis], CV_32F, 1, 0.5);
+    }
+
+    cv::Mat decoded;
+    cv::merge(axes, 2, decoded);
+    cv::Mat invalid;
+    cv::bitwise_not(valid, invalid);
+    decoded.setTo(cv::Scalar::all(-1), invalid);
+    return decoded;
+}
+
+RemapTable GrayCodePattern::remapTable(const cv::Mat &decoded) const {
+    int cell = std::max(1, m_parameters.cell);
+    cv::Size coarse((m_projector.width + cell - 1) / cell,
+                    (m_projector.height + cell - 1) / cell);
+
+    // Average camera position per projector cell
+    cv::Mat sums = cv::Mat::zeros(coarse, CV_32FC2);
+    cv::Mat counts = cv::Mat::zeros(coarse, CV_32F);
+    for (int y = 0; y < decoded.rows; y++) {
+        const cv::Vec2f *row = decoded.ptr<cv::Vec2f>(y);
+        for (int x = 0; x < decoded.cols; x++) {
+            if (row[x][0] < 0) continue;
+            int cx = int(row[x][0]) / cell;
+            int cy = int(row[x][1]) / cell;
+            sums.at<cv::Vec2f>(cy, cx) += cv::Vec2f(float(x), float(y));
+            counts.at<float>(cy, cx) += 1;
+        }
+    }
+
+    cv::Mat known;
+    cv::compare(counts, 0, known, cv::CMP_GT);
+    if (cv::countNonZero(known) == 0)
+        throw std::runtime_error("Gray code decoded nothing");
+
+    cv::Mat coarse_map(coarse, CV_32FC2, cv::Scalar::all(-1));
+    for (int y = 0; y < coarse.height; y++)
+        for (int x = 0; x < coarse.width; x++)
+            if (known.at<uchar>(y, x))
+                coarse_map.at<cv::Vec2f>(y, x) =
+                    sums.at<cv::Vec2f>(y, x) / counts.at<float>(y, x);
+
+    // Unseen cells take the nearest seen one, so interpolation near the
+    // edges stays sane
+    cv::Mat unknown, distance, labels;
+    cv::bitwise_not(known, unknown);
+    cv::distanceTransform(unknown, distance, labels, cv::DIST_L2,
+                          cv::DIST_MASK_5, cv::DIST_LABEL_PIXEL);
+    std::vector<cv::Vec2f> nearest(coarse.area() + 1);
+    for (int y = 0; y < coarse.height; y++)
+        for (int x = 0; x < coarse.width; x++)
+            if (known.at<uchar>(y, x))
+                nearest.at(labels.at<int>(y, x)) =
+                    coarse_map.at<cv::Vec2f>(y, x);
+    for (int y = 0; y < coarse.height; y++)
+        for (int x = 0; x < coarse.width; x++)
+            if (!known.at<uchar>(y, x))
+                coarse_map.at<cv::Vec2f>(y, x) =
+                    nearest.at(labels.at<int>(y, x));
+
+    // Cell centres line up with pixel centres under resize
+    cv::Mat full;
+    cv::resize(coarse_map, full, cv::Size(coarse.width * cell,
+                                          coarse.height * cell),
+               0, 0, cv::INTER_LINEAR);
+    full = full(cv::Rect(cv::Point(0, 0), m_projector)).clone();
+
+    RemapTable table;
+    cv::convertMaps(full, cv::noArray(), table.map, table.fraction, CV_16SC2);
+    return table;
+}
@@ -0,0 +1,241 @@
+#include "../headers/thread_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <exception>
+
+#include "opencv2/core/version.hpp"
+
+#if CV_VERSION_MAJOR > 4 ||                               \
+    (CV_VERSION_MAJOR == 4 &&                             \
+     (CV_VERSION_MINOR > 5 ||                             \
+      (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+#define THREAD_POOL_OPENCV_BACKEND
+#include "opencv2/core/parallel/parallel_backend.hpp"
+#endif
+
+namespace {
+thread_local int t_worker_index = -1;
+thread_local const ThreadPool *t_pool = nullptr;
+}  // namespace
+
+ThreadPool::ThreadPool(int workers, bool pin_threads, int first_core) {
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    if (workers <= 0) workers = cores;
+
+    for (int i = 0; i < workers; i++)
+        m_workers.push_back(std::make_unique<Worker>());
+
+    for (int i = 0; i < workers; i++) {
+        m_threads.emplace_back(&ThreadPool::run, this, i);
+        if (!pin_threads) continue;
+
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET((first_core + i) % cores, &cpu_set);
+        pthread_setaffinity_np(m_threads.back().native_handle(),
+                               sizeof(cpu_set), &cpu_set);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto &thread : m_threads) thread.join();
+}
+
+void ThreadPool::submit(Task task, Priority priority) {
+    // Workers keep their own subtasks local, others are spread round-robin
+    int index = (t_pool == this) ? t_worker_index
+                                 : m_next_worker++ % m_workers.size();
+    {
+        std::lock_guard<std::mutex> lock(m_workers.at(index)->mutex);
+        m_workers.at(index)->queues.at(priority).push_back(std::move(task));
+    }
+    m_queued++;
+    m_submitted++;
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    }
+    m_wake.notify_one();
+}
+
+void ThreadPool::parallelFor(int count,
+                             const std::function<void(int, int)> &body,
+                             Priority priority, int grain) {
+    if (count <= 0) return;
+    grain = std::max(1, grain);
+    int chunks = (count + grain - 1) / grain;
+
+    if (chunks == 1 || m_workers.empty()) {
+        body(0, count);
+        return;
+    }
+
+    struct Job {
+        std::atomic<int> next{0};
+        std::atomic<int> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+    auto job = std::make_shared<Job>();
+
+    // Helpers that start after every chunk was claimed return right away
+    // and never touch `body`
+    auto work = [job, &body, count, grain, chunks]() {
+        int chunk;
+        while ((chunk = job->next++) < chunks) {
+            int begin = chunk * grain;
+            try {
+                body(begin, std::min(count, begin + grain));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                if (!job->error) job->error = std::current_exception();
+            }
+            if (++job->done == chunks) {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->finished.notify_all();
+            }
+        }
+    };
+
+    int helpers = std::min(chunks - 1, workers());
+    for (int i = 0; i < helpers; i++) submit(work, priority);
+    work();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job, chunks] { return job->done == chunks; });
+    if (job->error) std::rethrow_exception(job->error);
+}
+
+int ThreadPool::workerIndex() { return t_worker_index; }
+
+ThreadPool::Stats ThreadPool::stats() const {
+    return {workers(), m_submitted.load(), m_executed.load(), m_stolen.load(),
+            m_queued.load()};
+}
+
+void ThreadPool::printStats(Printer &printer) const {
+    auto [workers, submitted, executed, stolen, queued] = stats();
+    auto b = Printer::DEBUG_LVL::BRIEF;
+
+    printer.log_message({Printer::INFO, {workers}, "pool workers", b});
+    printer.log_message(
+        {Printer::INFO, {int(submitted)}, "pool tasks submitted", b});
+    printer.log_message(
+        {Printer::INFO, {int(executed)}, "pool tasks executed", b});
+    printer.log_message({Printer::INFO, {int(stolen)}, "pool tasks stolen", b});
+    printer.log_message({Printer::INFO, {queued}, "pool tasks queued", b});
+}
+
+void ThreadPool::run(int index) {
+    t_worker_index = index;
+    t_pool = this;
+
+    Task task;
+    while (!m_stop) {
+        if (take(index, task)) {
+            task();
+            task = nullptr;
+            m_executed++;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+    }
+}
+
+bool ThreadPool::take(int index, Task &task) {
+    int count = workers();
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++) {
+        // Own queue: newest first, it is still hot in cache
+        {
+            auto &own = *m_workers.at(index);
+            std::lock_guard<std::mutex> lock(own.mutex);
+            auto &queue = own.queues.at(priority);
+            if (!queue.empty()) {
+                task = std::move(queue.back());
+                queue.pop_back();
+                m_queued--;
+                return true;
+            }
+        }
+
+        // Others: oldest first
+        for (int offset = 1; offset < count; offset++) {
+            auto &victim = *m_workers.at((index + offset) % count);
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            auto &queue = victim.queues.at(priority);
+            if (!queue.empty()) {
+                task = std::move(queue.front());
+                queue.pop_front();
+                m_queued--;
+                m_stolen++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+#ifdef THREAD_POOL_OPENCV_BACKEND
+namespace {
+class PoolParallelBackend : public cv::parallel::ParallelForAPI {
+    std::weak_ptr<ThreadPool> m_pool;
+
+   public:
+    PoolParallelBackend(std::shared_ptr<ThreadPool> pool) : m_pool(pool) {}
+
+    void parallel_for(int tasks, FN_parallel_for_body_cb_t body_callback,
+                      void *callback_data) override {
+        auto pool = m_pool.lock();
+        if (!pool) {
+            body_callback(0, tasks, callback_data);
+            return;
+        }
+
+        // OpenCV calls come from inside a stage that is waiting for them
+        pool->parallelFor(
+            tasks,
+            [body_callback, callback_data](int begin, int end) {
+                body_callback(begin, end, callback_data);
+            },
+            ThreadPool::HIGH);
+    }
+
+    // Callers outside of the pool share slot 0
+    int getThreadNum() const override {
+        return ThreadPool::workerIndex() + 1;
+    }
+
+    int getNumThreads() const override {
+        auto pool = m_pool.lock();
+        return pool ? pool->workers() + 1 : 1;
+    }
+
+    int setNumThreads(int) override { return getNumThreads(); }
+
+    const char *getName() const override { return "ThreadPool"; }
+};
+}  // namespace
+#endif
+
+void ThreadPool::useOpenCV(std::shared_ptr<ThreadPool> pool) {
+#ifdef THREAD_POOL_OPENCV_BACKEND
+    cv::parallel::setParallelForBackend(
+        std::make_shared<PoolParallelBackend>(pool), false);
+#else
+    // No pluggable backend: leave OpenCV the cores the pool does not use
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    cv::setNumThreads(std::max(1, cores - pool->workers()));
+#endif
+}
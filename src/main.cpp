@@ -3,15 +3,44 @@
 // #include <iostream>
 
 // #include "../include/sl_utils.hpp"
+#ifdef WITH_ZED
 #include "./headers/camera.hpp"
+#endif
+#include "./headers/depth_quantizer.hpp"
 // #include "./headers/converter.hpp"
+#include "./headers/events.hpp"
+#include "./headers/frame.hpp"
+#include "./headers/frame_source.hpp"
+#include "./headers/key_source.hpp"
+#include "./headers/latency.hpp"
+#include "./headers/movement.hpp"
+#include "./headers/output_sink.hpp"
+#include "./headers/pipeline.hpp"
+#include "./headers/quality.hpp"
+#include "./headers/recording.hpp"
 #include "./headers/settings.hpp"
-// #include "./impl/object_recognition.cpp"
+#include "./headers/shm_publisher.hpp"
+#include "./headers/structured_light.hpp"
+#include "./headers/thread_pool.hpp"
+#include "./headers/triple_buffer.hpp"
+#include "./impl/calibration.cpp"
+#include "./impl/depth_quantizer.cpp"
+#include "./impl/events.cpp"
+#include "./impl/frame_source.cpp"
+#include "./impl/key_source.cpp"
+#include "./impl/latency.cpp"
+#include "./impl/movement.cpp"
+#include "./impl/object_recognition.cpp"
+#include "./impl/output_sink.cpp"
+#include "./impl/quality.cpp"
+#include "./impl/recording.cpp"
+#include "./impl/shm_publisher.cpp"
+#include "./impl/structured_light.cpp"
 #include "./impl/templategen.cpp"
-// #include "./impl/utils.cpp"
+#include "./impl/thread_pool.cpp"
+#include "./impl/utils.cpp"
 
-#include <atomic>
-#include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 
@@ -30,8 +59,6 @@ using namespace std;
 
 // TODO free cam on process kill
 
-// TODO check for cam movement and activate recalibration
-
 // TODO join threads on kill
 
 void signalHandler(int signalNumber);
@@ -40,12 +67,51 @@ class Loop {
     Settings m_settings;
     Printer m_printer;
     Logger m_logger;
+    // Shared by every data-parallel job, OpenCV's included
+    std::shared_ptr<ThreadPool> m_pool;
     ImageProcessor m_image_processor;
-    Templates m_templates;
+    ImageProcessor m_morph_processor;  // owned by the preparation stage
+    Templates m_templates;         // owned by the display thread
+    Templates m_render_templates;  // owned by the render stage
 
     InteractiveState m_state;
-
-    vector<ImageProcessor::MatWithInfo> m_mask_mats;
+    std::unique_ptr<OutputSink> m_sink;  // projector frames
+    std::unique_ptr<KeySource> m_keys;
+    EventBus m_events;
+    LatencyTracer m_latency;
+    QualityController m_quality;
+    DepthQuantizer m_quantizer;  // owned by the capture thread
+    MovementDetector m_movement;  // owned by the capture thread
+    // Results for local readers, owned by the render stage
+    std::unique_ptr<ShmPublisher> m_publisher;
+    std::string m_shm_name;
+
+    // Reused by the segmentation stage on reduced quality levels
+    vector<ImageProcessor::MatWithInfo> m_last_objects;
+    cv::Mat m_last_labels;
+    int m_capture_events;
+    int m_display_events;
+
+    ViewDemand m_views;
+
+    // Shown this long before a structured light pattern is captured
+    const std::chrono::milliseconds m_pattern_settle{120};
+
+    // Key input is sampled this often while waiting for results
+    const std::chrono::milliseconds m_key_poll{30};
+
+    // Stage hand-off: capture -> prepare -> segment -> render
+    BoundedQueue<Frame> m_captured;
+    BoundedQueue<Frame> m_prepared;
+    BoundedQueue<Frame> m_segmented;
+
+    // Written by renderStage, read by showAndControl
+    TripleBuffer<FrameResult> m_results;
+    uint64_t m_frame_id = 0;
+    uint32_t m_calibration_id = 0;  // bumped by every calibration
+    RemapTable m_remap;  // of the last Gray code calibration, if any
+    bool m_cache_checked = false;     // cached calibration tried at startup
+    bool m_save_calibration = false;  // once the new reference is taken
     cv::Size m_resolution = {1280, 720};
 
     int moment_in_time = 0;
@@ -59,10 +125,40 @@ class Loop {
         : m_settings(sets),
           m_printer(print),
           m_logger(log),
+          m_pool(std::make_shared<ThreadPool>(sets.config.pool_workers,
+                                              sets.config.pool_pin,
+                                              sets.config.pool_first_core)),
           m_image_processor(img_proc),
-          m_templates(templates) {
-        setResolution(
-            static_cast<sl::RESOLUTION>(m_settings.config.camera_resolution));
+          m_morph_processor(img_proc),
+          m_templates(templates),
+          m_render_templates(templates),
+          m_events(print),
+          m_latency(print, sets.config.latency_period),
+          m_quality(print, sets.quality_ladder,
+                    sets.config.target_frame_time) {
+        setResolution(m_settings.config.camera_resolution);
+        m_shm_name = m_settings.config.shm_name;
+
+        setQueueDepth(m_settings.config.queue_depth);
+
+        // A recording replayed at full speed must not lose frames
+        if (m_settings.config.type == Config::SOURCE_TYPE::REPLAY &&
+            m_settings.config.replay_max_speed) {
+            m_captured.setPolicy(BoundedQueue<Frame>::BLOCK);
+            m_prepared.setPolicy(BoundedQueue<Frame>::BLOCK);
+            m_segmented.setPolicy(BoundedQueue<Frame>::BLOCK);
+        }
+
+        ThreadPool::useOpenCV(m_pool);
+
+        setQuantizer(m_settings.config);
+        setMovementCheck(m_settings.config);
+
+        m_capture_events = m_events.subscribe("capture");
+        m_display_events = m_events.subscribe("display");
+
+        m_views = ViewDemand::capture(m_state, m_settings.config,
+                                      m_save_calibration);
     }
 
     void Process() {
@@ -74,9 +170,9 @@ class Loop {
             case Config::SOURCE_TYPE::SVO:
                 zedProc();
                 break;
-            case Config::SOURCE_TYPE::STREAM: {
+            case Config::SOURCE_TYPE::STREAM:
+            case Config::SOURCE_TYPE::REPLAY: {
                 initInteractivity();
-                zedProc();
                 doTheLoop();
                 // cleanup();
             } break;
@@ -92,14 +188,43 @@ class Loop {
         m_image_processor.getImage(m_settings.config.file_path);
     }
 
-    void zedProc() { zed::CameraManager cam_man(m_printer); }
+    void zedProc() {
+#ifdef WITH_ZED
+        zed::CameraManager cam_man(m_printer);
+#endif
+    }
+
+    std::unique_ptr<FrameSource> makeFrameSource() {
+        if (m_settings.config.type == Config::SOURCE_TYPE::REPLAY)
+            return std::make_unique<ReplayFrameSource>(m_printer);
+#ifdef WITH_ZED
+        return std::make_unique<zed::ZedFrameSource>(m_printer);
+#else
+        throw runtime_error("Built without ZED support, only replay works");
+#endif
+    }
 
     void initInteractivity() {
         window_name = "Projection";
-        cv::namedWindow(window_name, cv::WindowFlags::WINDOW_NORMAL);
-        cv::setWindowProperty(window_name,
-                              cv::WindowPropertyFlags::WND_PROP_FULLSCREEN,
-                              cv::WindowFlags::WINDOW_FULLSCREEN);
+
+        auto sink = OutputSink::parse(m_settings.config.output_sink);
+        m_sink = OutputSink::make(sink, window_name,
+                                  m_settings.config.output_location);
+        m_sink->open();
+
+        // Only a window delivers its own keys; otherwise read the terminal
+        string keys = m_settings.config.key_source;
+        if (keys == "auto")
+            keys = sink == OutputSink::WINDOW ? "window" : "terminal";
+        // Nothing else would pump the window's events
+        if (sink == OutputSink::WINDOW && keys != "window")
+            throw runtime_error("The window sink takes window keys only, not " +
+                                keys);
+        m_keys = KeySource::make(KeySource::parse(keys));
+        m_state.read_key = [this](int timeout) {
+            return m_keys->read(timeout);
+        };
+
         // Templates templates(image.image);
         m_state.calibrate = true;
     }
@@ -110,66 +235,216 @@ class Loop {
         m_state.printHelp();
 
         std::thread readerThread(&Loop::acquireInformation, this);
+        std::thread prepareThread(&Loop::prepareStage, this);
+        std::thread segmentThread(&Loop::segmentStage, this);
+        std::thread renderThread(&Loop::renderStage, this);
         std::thread displayThread(&Loop::showAndControl, this);
 
-        // Wait for the threads to finish
+        // Wait for the threads to finish; stages stop once their input
+        // queue is closed and drained
         readerThread.join();
+        prepareThread.join();
+        segmentThread.join();
+        renderThread.join();
         displayThread.join();
-    }
-
-    std::mutex mats_mutex;
-    std::condition_variable mats_condition;
-    std::atomic<bool> mats_available{false};
-    std::atomic<bool> mats_changed{false};
 
-    std::mutex calibration_mutex;
-    std::condition_variable calibration_condition;
-    std::atomic<bool> imshow_available{true};
+        m_sink->close();
+        m_printer.log_message({Printer::INFO,
+                               {int(m_sink->shown())},
+                               "Frames shown",
+                               Printer::DEBUG_LVL::PRODUCTION});
+        if (m_publisher)
+            m_printer.log_message({Printer::INFO,
+                                   {int(m_publisher->published())},
+                                   "Frames published",
+                                   Printer::DEBUG_LVL::PRODUCTION});
+        m_events.printStats();
+        m_pool->printStats(m_printer);
+        m_latency.print();
+        if (m_settings.config.save_logs)
+            m_latency.dumpJson(m_settings.config.output_location +
+                               "latency.json");
+    }
 
+    // Guards m_settings and m_resolution between the threads
     std::mutex settings_mutex;
-    std::condition_variable settings_condition;
-    std::atomic<bool> settings_available{true};
 
     void acquireInformation() {
-        zed::CameraManager cam_man(m_printer);
+        std::unique_ptr<FrameSource> source;
+        try {
+            source = makeFrameSource();
+            source->open(m_settings.config);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << " in method 'acquireInformation'\n";
+            m_state.keep_running = false;
+            m_events.post(EventBus::SHUTDOWN);
+            m_captured.close();
+            return;
+        }
 
-        cam_man.openCam(m_settings.config);
+        // Started and stopped along with the record setting
+        std::unique_ptr<Recorder> recorder;
 
-        cv::Mat image = cv::Mat(m_resolution, CV_8UC1, double(0));
+        const uint32_t commands = EventBus::SETTINGS_CHANGED |
+                                  EventBus::CALIBRATION_REQUESTED |
+                                  EventBus::SHUTDOWN;
 
         while (m_state.keep_running) {
-            // TODO ensure that m_state commands are processed
+            m_events.poll(m_capture_events, commands);
+
             if (m_state.load_settings) {
-                settings_available = false;
                 std::lock_guard<std::mutex> lock(settings_mutex);
-                loadSettings(cam_man);
-                settings_available = true;
+                loadSettings(*source);
             }
-            settings_available.notify_one();
-            if (m_state.restart_cam) restartCamera(cam_man);
+            if (m_state.restart_cam) restartCamera(*source);
             if (m_state.calibrate) {
-                imshow_available = false;
-                std::lock_guard<std::mutex> lock(calibration_mutex);
-                calibrate(cam_man);
-                imshow_available = true;
+                // the display thread stays off the window meanwhile
+                // Only homographies are cached
+                bool homography = m_settings.config.calibration_mode == 0;
+                bool restored = !m_cache_checked && homography &&
+                                restoreCalibration(*source);
+                m_cache_checked = true;
+                if (!restored) {
+                    m_save_calibration = calibrate(*source) && homography;
+                    m_movement.reset();
+                }
+                m_state.calibrate = false;
+                m_calibration_id++;
+                m_events.post(EventBus::CALIBRATION_DONE);
             }
-            calibration_condition.notify_one();
-
-            auto returned_state = cam_man.grab();
-            if (m_state.grab && returned_state == sl::ERROR_CODE::SUCCESS)
-                grabImage(cam_man, image);
-
-            if (m_state.process) {
-                mats_available = false;
-                std::lock_guard<std::mutex> lock(mats_mutex);
-                postProcessing(image);
-                mats_available = true;
-                mats_changed = true;
+            if (m_settings.config.record != bool(recorder))
+                recorder = m_settings.config.record ? makeRecorder() : nullptr;
+
+            // Nothing to do until the display asks for something
+            if (!m_state.grab || !m_state.process) {
+                m_events.wait(m_capture_events, commands);
+                continue;
             }
-            mats_condition.notify_one();
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            // A finished recording ends the session
+            if (source->finished()) {
+                m_state.keep_running = false;
+                m_events.post(EventBus::SHUTDOWN);
+                break;
+            }
+
+            // Blocks until the source delivers the next frame
+            if (!source->grab()) {
+                // back off on camera errors unless told otherwise
+                m_events.waitFor(m_capture_events, commands, m_key_poll);
+                continue;
+            }
+
+            Frame frame;
+            frame.timestamps.mark(FrameTimestamps::GRAB);
+            if (grabImage(*source, frame, requiredViews())) {
+                // The first frame after calibration is the new reference
+                bool check_movement = m_settings.config.movement_every > 0 ||
+                                      m_save_calibration;
+                if (check_movement && m_movement.observe(frame.depth)) {
+                    cv::Point2d shift = m_movement.shift();
+                    m_printer.log_message(
+                        {Printer::INFO,
+                         {int(std::hypot(shift.x, shift.y))},
+                         "camera moved (px), recalibrating",
+                         Printer::DEBUG_LVL::PRODUCTION});
+                    m_state.calibrate = true;
+                    m_events.post(EventBus::CALIBRATION_REQUESTED);
+                }
+                if (m_save_calibration && m_movement.hasReference())
+                    saveCalibration(*source, frame.size);
+                // The recorder outlives the lease, borrowed depth is copied
+                if (recorder)
+                    recorder->push(
+                        frame.source ? frame.depth.clone() : frame.depth,
+                        frame.timestamps.captured, m_calibration_id,
+                        frame.homography, m_quantizer);
+                frame.id = ++m_frame_id;
+                m_captured.push(std::move(frame));
+                m_events.post(EventBus::FRAME_GRABBED);
+            }
+        }
+
+        m_captured.close();
+
+        auto stats = source->retrievalStats();
+        m_printer.log_message({Printer::INFO_RETRIEVAL,
+                               {int(stats.frames),
+                                int(stats.fetched_bytes >> 20),
+                                int(stats.skipped_bytes >> 20)},
+                               "views",
+                               Printer::DEBUG_LVL::PRODUCTION});
+    }
+
+    uint32_t requiredViews() {
+        return m_views.required(m_settings.config.metric_depth);
+    }
+
+    // Items over a smaller depth stay until they are popped or dropped
+    void setQueueDepth(int depth) {
+        m_captured.setCapacity(depth);
+        m_prepared.setCapacity(depth);
+        m_segmented.setCapacity(depth);
+    }
+
+    // Keeps the reference unless the interval changed
+    void setMovementCheck(const Config &config) {
+        MovementDetector::Parameters parameters = m_movement.parameters();
+        int every = std::max(1, config.movement_every);
+        if (parameters.every == every) return;
+        parameters.every = every;
+        m_movement.setParameters(parameters);
+    }
+
+    void setQuantizer(const Config &config) {
+        DepthQuantizer::Parameters parameters;
+        parameters.near = config.depth_near / 1000.0f;
+        parameters.far = config.depth_far / 1000.0f;
+        parameters.mapping = config.depth_mapping == 1
+                                 ? DepthQuantizer::INVERSE
+                                 : DepthQuantizer::LINEAR;
+        parameters.bits = config.depth_bits;
+        m_quantizer.setParameters(parameters);
+    }
+
+    std::unique_ptr<Recorder> makeRecorder() {
+        char stamp[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S",
+                      std::localtime(&now));
+        std::string path = m_settings.config.output_location + "recording_" +
+                           stamp + ".dgtr";
+        try {
+            return std::make_unique<Recorder>(
+                m_printer, path, RecordingWriter::bestCompression());
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << " in method 'makeRecorder'\n";
+            m_settings.config.record = false;
         }
+        return nullptr;
+    }
+
+    // Warp (unless in camera space), grayscale and erosion/dilation
+    void prepareStage() {
+        Frame frame;
+        while (m_captured.pop(frame)) {
+            if (prepareImage(frame)) m_prepared.push(std::move(frame));
+        }
+        m_prepared.close();
+    }
+
+    void segmentStage() {
+        Frame frame;
+        while (m_prepared.pop(frame)) {
+            if (segment(frame)) m_segmented.push(std::move(frame));
+        }
+        m_segmented.close();
+    }
+
+    // Composes the projector image and hands it over to the display
+    void renderStage() {
+        Frame frame;
+        while (m_segmented.pop(frame)) render(frame);
     }
 
     void showAndControl() {
@@ -183,81 +458,132 @@ class Loop {
                                    Printer::DEBUG_LVL::PRODUCTION});
         };
 
-        vector<ImageProcessor::MatWithInfo> mask_mats = m_mask_mats;
+        // The sink only gets images that changed, key polls alone show
+        // nothing; a file sink would fill up with copies otherwise
+        bool redraw = true;
+        InteractiveState::Mode shown_mode = m_state.mode;
+        int shown_level = m_state.scales.at(0).second;
 
         while (m_state.keep_running) {
             m_state.next = false;
             m_state.idx = 0;
 
-            if (mats_changed && mats_available) {
-                mask_mats = m_mask_mats;
-                m_printer.log_message({Printer::INFO,
-                                       {(int)mask_mats.size()},
-                                       "Changed masks, size",
-                                       Printer::DEBUG_LVL::PRODUCTION});
-                mats_changed = false;
+            // Calibration owns the window until it is done
+            while (m_state.calibrate && m_state.keep_running) {
+                redraw = true;
+                m_events.wait(m_display_events,
+                              EventBus::CALIBRATION_DONE | EventBus::SHUTDOWN);
             }
 
-            std::unique_lock<std::mutex> lock_settings(settings_mutex);
-            settings_condition.wait(
-                lock_settings, [this] { return settings_available.load(); });
-            std::unique_lock<std::mutex> lock_imshow(calibration_mutex);
-            mats_condition.wait(lock_imshow,
-                                [this] { return imshow_available.load(); });
-
-            switch (m_state.mode) {
-                case InteractiveState::Mode::NONE: {
-                    print_mode("NONE");
-                    image = cv::Mat::zeros(image.size(), CV_8UC4);
-                    break;
-                }
-                case InteractiveState::Mode::WHITE: {
-                    uchar brightness = m_state.scales.at(0).second * 25 + 5;
-                    print_mode("WHITE", brightness, "Brightness");
-                    image =
-                        cv::Mat(image.size(), CV_8UC3,
-                                cv::Scalar(brightness, brightness, brightness));
-                    break;
-                }
-                case InteractiveState::Mode::CHESS: {
-                    print_mode("CHESS");
-                    cv::Mat white(image.size(), CV_8UC1,
-                                  cv::Scalar(255, 255, 255));
-                    image = m_templates.chessBoard(0, white);
-                    break;
-                }
-                case InteractiveState::Mode::DEPTH: {
-                    print_mode("DEPTH");
-                    break;
-                }
-                case InteractiveState::Mode::OBJECTS: {
-                    print_mode("OBJECTS");
-
-                    if (!mats_available.load()) break;
-                    // std::unique_lock<std::mutex> lock_mats(mats_mutex);
-                    // mats_condition.wait(
-                    // lock_mats, [this] { return mats_available.load(); });
-                    // ! has problems, arrays are off??
-                    maskAgregator(image, mask_mats);
-                    break;
+            m_events.waitFor(m_display_events,
+                             EventBus::RESULT_READY | EventBus::SHUTDOWN,
+                             m_key_poll);
+
+            bool fresh = m_results.update();
+            bool shows_result = false;
+            if (fresh) {
+                m_printer.log_message(
+                    {Printer::INFO,
+                     {(int)m_results.readBuffer().objects.size()},
+                     "Changed masks, size",
+                     Printer::DEBUG_LVL::PRODUCTION});
+            }
+            const cv::Mat &render = m_results.readBuffer().render;
+
+            InteractiveState::Mode mode = m_state.mode;
+            int level = m_state.scales.at(0).second;
+            bool shows_render = mode == InteractiveState::Mode::OBJECTS ||
+                                mode == InteractiveState::Mode::TEMPLATES;
+            redraw = redraw || mode != shown_mode ||
+                     (mode == InteractiveState::Mode::WHITE &&
+                      level != shown_level) ||
+                     (shows_render && fresh);
+
+            if (redraw) {
+                switch (mode) {
+                    case InteractiveState::Mode::NONE: {
+                        print_mode("NONE");
+                        image = cv::Mat::zeros(image.size(), CV_8UC4);
+                        break;
+                    }
+                    case InteractiveState::Mode::WHITE: {
+                        uchar brightness = level * 25 + 5;
+                        print_mode("WHITE", brightness, "Brightness");
+                        image = cv::Mat(
+                            image.size(), CV_8UC3,
+                            cv::Scalar(brightness, brightness, brightness));
+                        break;
+                    }
+                    case InteractiveState::Mode::CHESS: {
+                        print_mode("CHESS");
+                        cv::Mat white(image.size(), CV_8UC1,
+                                      cv::Scalar(255, 255, 255));
+                        m_templates.setResolution(image.size());
+                        image = m_templates.chessBoard(0, white);
+                        break;
+                    }
+                    case InteractiveState::Mode::DEPTH: {
+                        print_mode("DEPTH");
+                        break;
+                    }
+                    case InteractiveState::Mode::OBJECTS: {
+                        print_mode("OBJECTS");
+
+                        shows_result = fresh && !render.empty();
+                        if (!render.empty()) image = render;
+                        break;
+                    }
+                    case InteractiveState::Mode::TEMPLATES: {
+                        print_mode("TEMPLATES");
+
+                        shows_result = fresh && !render.empty();
+                        if (!render.empty()) image = render;
+                        break;
+                    }
+                    default:
+                        break;
                 }
-                case InteractiveState::Mode::TEMPLATES: {
-                    print_mode("TEMPLATES");
 
-                    applyTemplates(image, mask_mats);
-                    break;
-                }
-                default:
-                    break;
+                m_sink->show(image);
+                shown_mode = mode;
+                shown_level = level;
+                redraw = false;
+            }
+            m_state.key = m_state.readKey(1);
+
+            if (shows_result) {
+                FrameTimestamps timestamps = m_results.readBuffer().timestamps;
+                timestamps.mark(FrameTimestamps::IMSHOW);
+                m_latency.record(timestamps);
+                if (m_latency.report()) m_pool->printStats(m_printer);
             }
 
-            imshow(window_name, image);
-            m_state.key = cv::waitKey(10);
             m_state.action();
+            postKeyEvents(m_state.key);
         }
     }
 
-    void loadSettings(zed::CameraManager &cam_man) {
+    // Tells the other threads what the pressed key asked for
+    void postKeyEvents(char key) {
+        switch (key) {
+            case 'q':
+                m_events.post(EventBus::SHUTDOWN);
+                break;
+            case 'c':
+                m_events.post(EventBus::CALIBRATION_REQUESTED);
+                break;
+            case 'l':
+            case 'r':
+            case 'g':
+            case 'h':
+                m_events.post(EventBus::SETTINGS_CHANGED);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void loadSettings(FrameSource &source) {
         try {
             m_printer.log_message({Printer::ERROR::INFO,
                                    {0},
@@ -265,12 +591,13 @@ class Loop {
                                    Printer::DEBUG_LVL::PRODUCTION});
             m_settings.ParseConfig();
 
-            cam_man.updateRunParams(m_settings.config);
-            cam_man.updateHough(m_settings.hough_params);
-            m_image_processor.setParametersFromSettings(m_settings.config);
-            setResolution(static_cast<sl::RESOLUTION>(
-                m_settings.config.camera_resolution));
-            m_templates.setResolution(m_resolution);
+            source.updateRunParams(m_settings.config);
+            setQuantizer(m_settings.config);
+            m_quality.setLadder(m_settings.quality_ladder,
+                                m_settings.config.target_frame_time);
+            setMovementCheck(m_settings.config);
+            setResolution(m_settings.config.camera_resolution);
+            setQueueDepth(m_settings.config.queue_depth);
             m_state.load_settings = false;
         } catch (const std::exception &e) {
             std::cerr << e.what() << 'in method \'loadSettings\'\n';
@@ -278,7 +605,7 @@ class Loop {
         }
     }
 
-    void restartCamera(zed::CameraManager &cam_man) {
+    void restartCamera(FrameSource &source) {
         try {
             m_printer.log_message({Printer::ERROR::INFO,
                                    {0},
@@ -286,8 +613,7 @@ class Loop {
                                    Printer::DEBUG_LVL::PRODUCTION});
             m_settings.ParseConfig();
 
-            cam_man.restartCamera(m_settings.config);
-            cam_man.updateHough(m_settings.hough_params);
+            source.restart(m_settings.config);
             m_state.restart_cam = false;
         } catch (const std::exception &e) {
             std::cerr << e.what() << 'in method \'restartCamera\'\n';
@@ -295,70 +621,395 @@ class Loop {
         }
     }
 
-    void calibrate(zed::CameraManager &cam_man) {
+    bool calibrate(FrameSource &source) {
+        bool calibrated = false;
         try {
-            cam_man.calibrate(window_name, m_state,
-                              m_settings.config.output_location, 15000);
+            if (m_settings.config.calibration_mode == 1) {
+                calibrated = calibrateStructuredLight(source);
+            } else {
+                CalibrationDetector::Parameters parameters;
+                parameters.budget = std::chrono::milliseconds(
+                    m_settings.config.calibration_budget);
+                calibrated = source.calibrate(
+                    *m_sink, m_state, m_settings.config.output_location,
+                    parameters);
+                if (calibrated) m_remap = RemapTable();
+            }
             m_state.calibrate = false;
         } catch (const std::exception &e) {
             std::cerr << "Calibration failed; " << e.what()
                       << 'in method \'calibrate\'\n';
             m_state.calibrate = false;
         }
+        return calibrated;
     }
 
-    void grabImage(zed::CameraManager &cam_man, cv::Mat &image) {
+    // Projects the Gray code sequence and keeps the decoded mapping as
+    // the remap table; the homography of the source stays as it was
+    bool calibrateStructuredLight(FrameSource &source) {
+        auto started = std::chrono::steady_clock::now();
+
+        // Patterns are rendered at the size frames are rendered at
+        auto capture = [&source](cv::Mat &gray) {
+            SourceFrame retrieved;
+            // The first grab may still show the previous pattern
+            for (int i = 0; i < 2; i++)
+                if (!source.grab()) return false;
+            if (!source.retrieve(retrieved, FrameSource::GRAY) ||
+                retrieved.gray.empty())
+                return false;
+            if (retrieved.gray.channels() == 4)
+                cv::cvtColor(retrieved.gray, gray, cv::COLOR_BGRA2GRAY);
+            else
+                gray = retrieved.gray.clone();
+            return true;
+        };
+
+        cv::Mat first;
+        if (!capture(first))
+            throw runtime_error("Gray code calibration needs gray views");
+        GrayCodePattern patterns(first.size());
+
+        std::vector<cv::Mat> captures;
+        for (int i = 0; i < patterns.count() && m_state.calibrate; i++) {
+            m_sink->show(patterns.pattern(i));
+            // Projector and camera latency
+            m_state.key = m_state.readKey(m_pattern_settle.count());
+            m_state.action();
+
+            cv::Mat gray;
+            if (!capture(gray)) return false;
+            captures.push_back(gray);
+        }
+        if (int(captures.size()) != patterns.count()) return false;
+
+        cv::Mat decoded = patterns.decode(captures);
+        m_remap = patterns.remapTable(decoded);
+
+        cv::Mat channels[2];
+        cv::split(decoded, channels);
+        int decoded_pixels = cv::countNonZero(channels[0] >= 0);
+        m_printer.log_message(
+            {Printer::INFO_CALIBRATION,
+             {patterns.count(),
+              int(std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - started)
+                      .count()),
+              decoded_pixels},
+             "structured light",
+             Printer::DEBUG_LVL::PRODUCTION});
+        return true;
+    }
+
+    std::string calibrationCachePath() {
+        return m_settings.config.output_location + "calibration.yml.gz";
+    }
+
+    // The cached calibration holds if one fresh frame still matches its
+    // reference; nothing gets projected meanwhile
+    bool restoreCalibration(FrameSource &source) {
+        try {
+            CalibrationCache cache;
+            std::string serial = source.serial();
+            if (serial.empty() || !cache.load(calibrationCachePath()) ||
+                cache.serial != serial)
+                return false;
+
+            Frame frame;
+            uint32_t depth = m_settings.config.metric_depth
+                                 ? FrameSource::METRIC_DEPTH
+                                 : FrameSource::DEPTH;
+            if (!source.grab() || !grabImage(source, frame, depth) ||
+                frame.size != cache.resolution)
+                return false;
+
+            m_movement.setReference(cache.reference);
+            if (!m_movement.matches(frame.depth)) {
+                m_movement.reset();
+                m_printer.log_message({Printer::INFO,
+                                       {0},
+                                       "cached calibration outdated",
+                                       Printer::DEBUG_LVL::PRODUCTION});
+                return false;
+            }
+
+            source.restoreCalibration(cache.homography, cache.roi);
+            m_printer.log_message({Printer::INFO,
+                                   {1},
+                                   "cached calibration restored",
+                                   Printer::DEBUG_LVL::PRODUCTION});
+            return true;
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << " in method 'restoreCalibration'\n";
+        }
+        return false;
+    }
+
+    void saveCalibration(FrameSource &source, cv::Size size) {
+        m_save_calibration = false;
+        CalibrationCache cache;
+        cache.serial = source.serial();
+        if (cache.serial.empty()) return;
+
+        cache.resolution = size;
+        cache.homography = source.homography();
+        cache.roi = source.roi();
+        cache.reference = m_movement.reference();
         try {
-            cam_man.imageProcessing(false);
-            int height = cam_man.image_depth_cv.rows;
-            int width = cam_man.image_depth_cv.cols;
-            cv::Mat transformed(height, width, CV_8UC1);
-            cv::warpPerspective(cam_man.image_depth_cv, transformed,
-                                cam_man.homography, cv::Size(width, height));
-            image = transformed;
+            cache.save(calibrationCachePath());
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << " in method 'saveCalibration'\n";
+        }
+    }
 
+    // False if the frame has nothing for the pipeline
+    bool grabImage(FrameSource &source, Frame &frame, uint32_t views) {
+        try {
+            SourceFrame retrieved;
+            if (!source.retrieve(retrieved, views)) return false;
+
+            // Leased views travel with the frame until it is prepared, others
+            // are reused by the next retrieve and copied. Quantizing writes
+            // a fresh buffer either way.
+            frame.timestamps.captured = retrieved.captured;
+            if (!retrieved.metric_depth.empty())
+                m_quantizer.quantize(retrieved.metric_depth, frame.depth);
+            else if (retrieved.depth.empty())
+                return false;
+            else if (retrieved.buffers) {
+                frame.depth = retrieved.depth;
+                frame.source = retrieved.buffers;
+            } else
+                frame.depth = retrieved.depth.clone();
+            frame.size = frame.depth.size();
+            frame.roi = source.roi();
+            frame.homography = source.homography();
+            frame.remap = m_remap;
+            frame.timestamps.mark(FrameTimestamps::RETRIEVE);
+            return true;
         } catch (const std::exception &e) {
             std::cerr << "Image processing failed; " << e.what()
-                      << 'in method \'grabImage\'\n';
+                      << " in method 'grabImage'\n";
         }
+        return false;
     }
 
-    void postProcessing(cv::Mat &image) {
+    bool prepareImage(Frame &frame) {
         try {
-            m_image_processor.mask_mats.clear();
+            auto started = Frame::clock::now();
+            frame.quality = m_quality.level();
 
+            bool camera_space;
+            vector<ErosionDilation> erodil;
+            {
+                std::lock_guard<std::mutex> lock(settings_mutex);
+                camera_space = m_settings.config.camera_space;
+                erodil = m_settings.erodil;
+            }
+
+            // Raw depth limited to the ROI; only the masks get warped later.
+            // The captured depth is shared with the recorder, never modify it
+            if (camera_space) {
+                if (frame.roi.size() == frame.depth.size()) {
+                    frame.image = cv::Mat::zeros(frame.depth.size(),
+                                                 frame.depth.type());
+                    frame.depth.copyTo(frame.image, frame.roi);
+                } else
+                    frame.image = frame.depth.clone();
+            } else if (!frame.remap.empty()) {
+                frame.remap.apply(frame.depth, frame.image);
+            } else {
+                cv::warpPerspective(frame.depth, frame.image, frame.homography,
+                                    frame.depth.size());
+            }
+            frame.timestamps.mark(FrameTimestamps::WARP);
+
+            // The working image is a copy, hand the capture buffer back
+            frame.depth.release();
+            frame.source.reset();
+
+            cv::Mat &image = frame.image;
             if (image.channels() == 4) cvtColor(image, image, COLOR_BGRA2GRAY);
             if (image.channels() == 3) cvtColor(image, image, COLOR_BGR2GRAY);
 
-            m_image_processor.getImage(&image);
+            float scale = frame.quality.scale;
+            if (scale < 1)
+                cv::resize(image, image, cv::Size(), scale, scale,
+                           cv::INTER_AREA);
+
+            m_morph_processor.getImage(&image);
 
-            for (auto action : m_settings.erodil) {
+            int passes = frame.quality.erodil_passes;
+            if (passes < 0 || passes > erodil.size()) passes = erodil.size();
+            for (int i = 0; i < passes; i++) {
+                auto action = erodil.at(i);
+                int size = std::max(1, int(action.size * scale));
                 if (action.type == ErosionDilation::Dilation)
-                    m_image_processor.dilate(action.distance, action.size);
+                    m_morph_processor.dilate(action.distance, size);
                 else
-                    m_image_processor.erode(action.distance, action.size);
+                    m_morph_processor.erode(action.distance, size);
             }
+            frame.timestamps.mark(FrameTimestamps::MORPHOLOGY);
+
+            frame.work += std::chrono::duration_cast<std::chrono::microseconds>(
+                Frame::clock::now() - started);
+            return true;
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << " in method 'prepareImage'\n";
+        }
+        return false;
+    }
 
-            m_image_processor.setParametersFromSettings(m_settings.config);
+    bool segment(Frame &frame) {
+        try {
+            auto started = Frame::clock::now();
+
+            Config config;
+            {
+                std::lock_guard<std::mutex> lock(settings_mutex);
+                config = m_settings.config;
+            }
+            float scale = frame.quality.scale;
+            config.min_area = int(config.min_area * scale * scale);
+            m_image_processor.setParametersFromSettings(config);
+
+            // Lower quality levels reuse the last objects in between
+            if (frame.id % frame.quality.segment_every != 0 &&
+                !m_last_labels.empty()) {
+                frame.objects = m_last_objects;
+                frame.labels = m_last_labels;
+                frame.timestamps.mark(FrameTimestamps::SEGMENTATION);
+                return true;
+            }
+
+            m_image_processor.mask_mats.clear();
+            m_image_processor.getImage(&frame.image);
             m_image_processor.findObjects();
 
-            m_mask_mats = m_image_processor.mask_mats;
+            // Results always leave this stage in full resolution
+            cv::Size full = frame.size;
+            if (config.camera_space && !frame.remap.empty()) {
+                for (auto &mask : m_image_processor.mask_mats) {
+                    if (scale < 1)
+                        cv::resize(mask.mat, mask.mat, full, 0, 0,
+                                   cv::INTER_NEAREST);
+                    frame.remap.apply(mask.mat.clone(), mask.mat,
+                                      cv::INTER_NEAREST);
+                }
+            } else if (config.camera_space) {
+                cv::Mat homography = frame.homography;
+                if (scale < 1 && !homography.empty()) {
+                    cv::Mat unscale = (cv::Mat_<double>(3, 3) << 1 / scale, 0,
+                                       0, 0, 1 / scale, 0, 0, 0, 1);
+                    homography = homography * unscale;
+                }
+                m_image_processor.warpMasks(homography, full);
+            } else if (scale < 1) {
+                for (auto &mask : m_image_processor.mask_mats)
+                    cv::resize(mask.mat, mask.mat, full, 0, 0,
+                               cv::INTER_NEAREST);
+            }
+
+            m_image_processor.describeMasks();
+            frame.objects.swap(m_image_processor.mask_mats);
+            frame.labels = m_image_processor.m_objects;
+            if (scale < 1)
+                cv::resize(frame.labels, frame.labels, full, 0, 0,
+                           cv::INTER_NEAREST);
+            m_last_objects = frame.objects;
+            m_last_labels = frame.labels;
+            frame.timestamps.mark(FrameTimestamps::SEGMENTATION);
+
+            frame.work += std::chrono::duration_cast<std::chrono::microseconds>(
+                Frame::clock::now() - started);
+            return true;
         } catch (const std::exception &e) {
-            std::cerr << e.what() << 'in method \'postProcessing\'\n';
-            m_state.load_settings = false;
+            std::cerr << e.what() << " in method 'segment'\n";
+        }
+        return false;
+    }
+
+    void render(Frame &frame) {
+        auto started = Frame::clock::now();
+
+        cv::Size resolution;
+        {
+            std::lock_guard<std::mutex> lock(settings_mutex);
+            resolution = m_resolution;
+        }
+        m_render_templates.setResolution(resolution);
+
+        FrameResult &result = m_results.writeBuffer();
+        result.frame_id = frame.id;
+        result.objects.swap(frame.objects);
+        result.labels = frame.labels;
+
+        result.render = cv::Mat(frame.size, CV_8UC3);
+        switch (m_state.mode) {
+            case InteractiveState::Mode::OBJECTS:
+                maskAgregator(result.render, result.objects);
+                break;
+            case InteractiveState::Mode::TEMPLATES:
+                applyTemplates(result.render, result.objects,
+                               frame.quality.simple_templates);
+                break;
+            default:
+                result.render = cv::Mat();
+                break;
+        }
+
+        frame.timestamps.mark(FrameTimestamps::COMPOSITING);
+        result.timestamps = frame.timestamps;
+        publishResult(result, frame.size);
+        m_results.publish();
+        m_events.post(EventBus::RESULT_READY);
+
+        frame.work += std::chrono::duration_cast<std::chrono::microseconds>(
+            Frame::clock::now() - started);
+        m_quality.observe(frame.work);
+    }
+
+    // The first frame fixes the size of the shared memory slots
+    void publishResult(const FrameResult &result, cv::Size size) {
+        if (m_shm_name.empty()) return;
+        const cv::Mat &render = result.render;
+        try {
+            // A new resolution or pixel format gets a new ring, readers
+            // see the old one retired and reopen it
+            if (m_publisher && render.depth() == CV_8U &&
+                !m_publisher->fits(render)) {
+                m_printer.log_message({Printer::INFO,
+                                       {render.cols, render.rows},
+                                       "shared memory ring resized, size",
+                                       Printer::DEBUG_LVL::PRODUCTION});
+                m_publisher.reset();
+            }
+            if (!m_publisher) {
+                int max_objects;
+                {
+                    std::lock_guard<std::mutex> lock(settings_mutex);
+                    max_objects = m_settings.config.max_objects;
+                }
+                if (!render.empty()) size = render.size();
+                int channels = render.empty() ? 3 : render.channels();
+                m_publisher = std::make_unique<ShmPublisher>(
+                    m_shm_name, size, channels, max_objects);
+            }
+            m_publisher->publish(result.frame_id, result.timestamps.captured,
+                                 render, result.objects);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << " in method 'publishResult'\n";
+            m_shm_name.clear();
         }
     }
 
     void maskAgregator(cv::Mat &image,
-                       vector<ImageProcessor::MatWithInfo> &mask_mats) {
+                       const vector<ImageProcessor::MatWithInfo> &mask_mats) {
         try {
-            for (auto mask : mask_mats) {
-                image = cv::Mat::zeros(image.size(), CV_8UC3);
-                // std::cout << "mat1 size: " << image.size()
-                //           << ", channels: " << image.channels() << std::endl;
-                // std::cout << "mat2 size: " << mat2.size()
-                //           << ", channels: " << mat2.channels() << std::endl;
-                cv::add(image, mask.mat, image);
+            image = cv::Mat::zeros(image.size(), CV_8UC3);
+            for (const auto &mask : mask_mats) {
+                // masks are single channel, paint them white
+                image.setTo(cv::Scalar::all(255), mask.mat);
             }
         } catch (const std::exception &e) {
             std::cerr << e.what() << '\n';
@@ -366,7 +1017,8 @@ class Loop {
     }
 
     void applyTemplates(cv::Mat &image,
-                        vector<ImageProcessor::MatWithInfo> &mask_mats) {
+                        const vector<ImageProcessor::MatWithInfo> &mask_mats,
+                        bool simple = false) {
         try {
             // TODO color coding for objects via tamplates
             // use settings to define template characteristics
@@ -375,11 +1027,17 @@ class Loop {
             // cleanup; 1 channels
             image = cv::Mat::zeros(image.size(), CV_8UC3);
 
-            cv::Mat result(image.size(), image.type());
-            for (auto mask : mask_mats) {
-                result = m_templates.gradient(moment_in_time, mask.mat, 5);
-                cv::add(image, result, image);
-            }
+            // one full frame layer per object, summed below
+            vector<cv::Mat> layers(mask_mats.size());
+            m_pool->parallelFor(mask_mats.size(), [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                    layers.at(i) =
+                        simple ? m_render_templates.solidColor(
+                                     mask_mats.at(i).mat, cv::Scalar(0, 255, 0))
+                               : m_render_templates.gradient(
+                                     moment_in_time, mask_mats.at(i).mat, 5);
+            });
+            for (const auto &layer : layers) cv::add(image, layer, image);
 
             imwrite(m_settings.config.output_location + "templated_image.png",
                     image);
@@ -391,8 +1049,10 @@ class Loop {
         }
     }
 
-    void setResolution(sl::RESOLUTION resolution) {
-        switch (resolution) {
+    // Without the SDK the projector resolution keeps its default
+    void setResolution(int resolution) {
+#ifdef WITH_ZED
+        switch (static_cast<sl::RESOLUTION>(resolution)) {
             case sl::RESOLUTION::HD720:
                 m_resolution = {1280, 720};
                 break;
@@ -404,6 +1064,7 @@ class Loop {
                 throw runtime_error("Unsupported resolution");
                 break;
         }
+#endif
     }
 };
 
@@ -0,0 +1,127 @@
+// Test reader for the shared memory results of ImageProcessing --shm_name.
+//
+//   ShmReader <name> [frames]
+//
+// Follows the ring until the given number of frames was read (forever by
+// default), checks every frame for consistency and prints what it got once
+// a second. A retired ring is reopened by name. Exits with 1 if any check
+// failed.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+#include "./headers/shm_ring.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <name> [frames]\n", argv[0]);
+        return 2;
+    }
+    long limit = argc > 2 ? std::atol(argv[2]) : 0;
+
+    try {
+        auto reader = std::make_unique<ShmReader>(argv[1]);
+        auto describe = [&] {
+            const ShmRing::Header &header = reader->header();
+            std::printf("%s: %u slots of %ux%ux%u, %u objects max\n",
+                        argv[1], header.slot_count, header.max_width,
+                        header.max_height, header.channels,
+                        header.max_objects);
+        };
+        describe();
+
+        long frames = 0;
+        long failures = 0;
+        uint64_t last_frame_id = 0;
+        uint64_t objects = 0;
+        uint64_t checksum = 0;
+        int64_t latency_ns = 0;
+        auto report = clock_type::now();
+
+        while (limit == 0 || frames < limit) {
+            // Everything is checked on a copy of the header, the slot may
+            // be rewritten any moment
+            ShmRing::SlotHeader slot;
+            bool valid = true;
+            uint64_t sum = 0;
+            const ShmRing::Header &header = reader->header();
+            bool read = reader->readLatest([&](const ShmReader::View &view) {
+                slot.frame_id = view.slot->frame_id;
+                slot.captured_ns = view.slot->captured_ns;
+                slot.width = view.slot->width;
+                slot.height = view.slot->height;
+                slot.object_count = view.slot->object_count;
+
+                valid = slot.width <= header.max_width &&
+                        slot.height <= header.max_height &&
+                        slot.object_count <= header.max_objects;
+                if (!valid) return;
+
+                for (uint32_t i = 0; i < slot.object_count; i++) {
+                    const ShmRing::ObjectInfo &object = view.objects[i];
+                    if (slot.width == 0) continue;
+                    valid &= object.x >= 0 && object.y >= 0 &&
+                             object.x + object.width <= int(slot.width) &&
+                             object.y + object.height <= int(slot.height);
+                }
+
+                // Touch every row, as a consumer would
+                size_t row = size_t(slot.width) * view.channels;
+                for (uint32_t y = 0; y < slot.height; y++)
+                    sum += view.pixels[y * row + row / 2];
+            });
+
+            if (!read) {
+                // Frames of another size went to a new ring, which may
+                // not be there yet
+                if (reader->retired()) {
+                    try {
+                        reader = std::make_unique<ShmReader>(argv[1]);
+                        describe();
+                    } catch (const std::exception &) {
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                continue;
+            }
+
+            if (!valid || (frames > 0 && slot.frame_id <= last_frame_id)) {
+                std::fprintf(stderr, "frame %llu failed the checks\n",
+                             (unsigned long long)slot.frame_id);
+                failures++;
+            }
+            last_frame_id = slot.frame_id;
+            checksum += sum;
+            objects += slot.object_count;
+            latency_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              clock_type::now().time_since_epoch())
+                              .count() -
+                          slot.captured_ns;
+            frames++;
+
+            if (clock_type::now() - report >= std::chrono::seconds(1) ||
+                frames == limit) {
+                std::printf(
+                    "frames %ld, last id %llu, skipped %llu, torn %llu, "
+                    "objects/frame %.2f, capture to read %.2f ms\n",
+                    frames, (unsigned long long)last_frame_id,
+                    (unsigned long long)reader->skipped(),
+                    (unsigned long long)reader->torn(),
+                    double(objects) / frames, latency_ns / 1e6 / frames);
+                report = clock_type::now();
+            }
+        }
+
+        std::printf("checksum %llu, %ld failures\n",
+                    (unsigned long long)checksum, failures);
+        return failures == 0 ? 0 : 1;
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -1,12 +1,33 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <map>
 #include <opencv2/core/mat.hpp>
 #include <opencv2/core/matx.hpp>
 #include <opencv2/core/types.hpp>
+#include <thread>
 
 #include "../src/headers/object_recognition.hpp"
+#include "../src/headers/triple_buffer.hpp"
 #include "../src/headers/utils.hpp"
 
+// Unity build like main.cpp, only sources that need no camera
+#include "../src/impl/calibration.cpp"
+#include "../src/impl/depth_quantizer.cpp"
+#include "../src/impl/events.cpp"
+#include "../src/impl/frame_source.cpp"
+#include "../src/impl/latency.cpp"
+#include "../src/impl/mesh.cpp"
+#include "../src/impl/movement.cpp"
+#include "../src/impl/ply_writer.cpp"
+#include "../src/impl/quality.cpp"
+#include "../src/impl/point_cloud.cpp"
+#include "../src/impl/recording.cpp"
+#include "../src/impl/shm_publisher.cpp"
+#include "../src/impl/structured_light.cpp"
+#include "../src/impl/thread_pool.cpp"
+#include "../src/impl/utils.cpp"
+
 double getPointToPlaneDistance(cv::Vec3d plane_point, cv::Vec3d plane_vector,
                                cv::Vec3d point) {
     auto dot =
@@ -67,4 +88,953 @@ TEST(VectorSuit, Closeness) {
 
     // double dist4 = getPointToPlaneDistance({0, 0, 0}, {0, 0, 0}, {0, 0,
     // 0}); EXPECT_EQ(nan, dist4);
-}
\ No newline at end of file
+}
+// Camera that sees the projector image twice as large, shifted by (10, 8)
+cv::Mat seenByCamera(const cv::Mat &projected) {
+    cv::Mat warp = (cv::Mat_<double>(2, 3) << 2, 0, 10, 0, 2, 8);
+    cv::Mat captured;
+    cv::warpAffine(projected, captured, warp, {640, 480}, cv::INTER_NEAREST);
+    return captured;
+}
+
+TEST(StructuredLightSuit, DecodeAndRemap) {
+    GrayCodePattern patterns({300, 200});
+    std::vector<cv::Mat> captures;
+    for (int i = 0; i < patterns.count(); i++)
+        captures.push_back(seenByCamera(patterns.pattern(i)));
+
+    cv::Mat decoded = patterns.decode(captures);
+    ASSERT_EQ(decoded.size(), cv::Size(640, 480));
+    for (int y = 8; y < 8 + 2 * 200; y += 7) {
+        for (int x = 10; x < 10 + 2 * 300; x += 7) {
+            cv::Vec2f seen = decoded.at<cv::Vec2f>(y, x);
+            EXPECT_NEAR((x - 10) / 2.0, seen[0], 1.0);
+            EXPECT_NEAR((y - 8) / 2.0, seen[1], 1.0);
+        }
+    }
+    // Outside the projection nothing is lit
+    EXPECT_EQ(-1, decoded.at<cv::Vec2f>(2, 2)[0]);
+
+    // Remapping camera x coordinates gives back where each projector
+    // pixel was seen
+    RemapTable table = patterns.remapTable(decoded);
+    ASSERT_EQ(table.size(), cv::Size(300, 200));
+    cv::Mat camera_x(480, 640, CV_32F);
+    for (int x = 0; x < 640; x++) camera_x.col(x).setTo(x);
+    cv::Mat projected_x;
+    table.apply(camera_x, projected_x);
+    for (int y = 10; y < 190; y += 9)
+        for (int x = 10; x < 290; x += 9)
+            EXPECT_NEAR(2 * x + 10, projected_x.at<float>(y, x), 2.0);
+}
+
+TEST(PointCloudSuit, BackProjectPlane) {
+    // Plane 2 m in front of the camera, one pixel without depth
+    CameraIntrinsics intrinsics{500, 400, 3.5f, 2.5f};
+    BackProjector projector(intrinsics, {8, 6});
+    cv::Mat depth(6, 8, CV_32FC1, cv::Scalar(2.0f));
+    depth.at<float>(1, 1) = NAN;
+    cv::Mat bgra(6, 8, CV_8UC4, cv::Scalar(10, 20, 30, 40));
+    cv::Mat bgr(6, 8, CV_8UC3, cv::Scalar(10, 20, 30));
+
+    cv::Mat cloud;
+    for (const cv::Mat &color : {bgra, bgr, cv::Mat()}) {
+        // RGBA bytes in memory, opaque if there is no alpha
+        cv::Vec4b expected(0, 0, 0, 0);
+        if (!color.empty())
+            expected = {30, 20, 10, uchar(color.channels() == 4 ? 40 : 255)};
+
+        projector.project(depth, color, cloud);
+        ASSERT_EQ(CV_32FC4, cloud.type());
+        ASSERT_EQ(depth.size(), cloud.size());
+
+        for (int y = 0; y < 6; y++) {
+            for (int x = 0; x < 8; x++) {
+                const cv::Vec4f &point = cloud.at<cv::Vec4f>(y, x);
+                if (x == 1 && y == 1) {
+                    EXPECT_TRUE(std::isnan(point[2]));
+                } else {
+                    EXPECT_FLOAT_EQ((x - 3.5f) / 500 * 2, point[0]);
+                    EXPECT_FLOAT_EQ(-(y - 2.5f) / 400 * 2, point[1]);
+                    EXPECT_FLOAT_EQ(-2, point[2]);
+                }
+
+                auto packed = reinterpret_cast<const uchar *>(&point[3]);
+                EXPECT_EQ(expected, cv::Vec4b(packed[0], packed[1], packed[2],
+                                              packed[3]));
+            }
+        }
+    }
+
+    EXPECT_THROW(BackProjector({0, 0, 0, 0}, {8, 6}), std::runtime_error);
+    EXPECT_THROW(projector.project(depth(cv::Rect(0, 0, 4, 4)), bgra, cloud),
+                 std::runtime_error);
+}
+
+// Organised cloud on the pixel grid with the pixel id in the fourth float,
+// NaN at the holes
+cv::Mat gridCloud(int rows, int cols, std::vector<cv::Point> holes = {}) {
+    cv::Mat cloud(rows, cols, CV_32FC4);
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < cols; x++)
+            cloud.at<cv::Vec4f>(y, x) = {float(x), float(-y), -1,
+                                         float(y * cols + x)};
+    for (cv::Point hole : holes) cloud.at<cv::Vec4f>(hole)[2] = NAN;
+    return cloud;
+}
+
+// Pixel ids of the vertices, which are copies of their points
+std::vector<int> vertexIds(const cv::Mat &cloud, const Mesh &mesh) {
+    std::vector<int> ids;
+    for (const cv::Vec4f &vertex : mesh.vertices) {
+        int id = vertex[3];
+        EXPECT_EQ(cloud.at<cv::Vec4f>(id / cloud.cols, id % cloud.cols),
+                  vertex);
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+TEST(MeshSuit, GridHoles) {
+    GridMesher mesher;
+    Mesh mesh;
+
+    // A hole in the middle leaves the corner triangles of the first and
+    // the last row and column
+    cv::Mat cloud = gridCloud(3, 3, {{1, 1}});
+    mesher.triangulate(cloud, mesh);
+    EXPECT_EQ(std::vector<int>({0, 1, 3, 5, 7, 8}), vertexIds(cloud, mesh));
+    EXPECT_EQ(std::vector<cv::Vec3i>({{0, 1, 2}, {3, 4, 5}}), mesh.triangles);
+
+    // A hole in the last column keeps both triangles of the first block
+    cloud = gridCloud(2, 3, {{2, 1}});
+    mesher.triangulate(cloud, mesh);
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4}), vertexIds(cloud, mesh));
+    EXPECT_EQ(std::vector<cv::Vec3i>({{0, 1, 3}, {1, 3, 4}, {1, 2, 4}}),
+              mesh.triangles);
+
+    // Without a hole every point is used, row by row
+    cloud = gridCloud(3, 4);
+    mesher.triangulate(cloud, mesh);
+    EXPECT_EQ(12u, mesh.vertices.size());
+    EXPECT_EQ(12u, mesh.triangles.size());
+    EXPECT_EQ(cv::Vec3i(6, 7, 10), mesh.triangles[10]);
+    EXPECT_EQ(cv::Vec3i(7, 10, 11), mesh.triangles[11]);
+
+    // Too few rows or columns for a block
+    mesher.triangulate(gridCloud(1, 5), mesh);
+    EXPECT_TRUE(mesh.vertices.empty());
+    EXPECT_TRUE(mesh.triangles.empty());
+    mesher.triangulate(gridCloud(5, 1), mesh);
+    EXPECT_TRUE(mesh.triangles.empty());
+}
+
+TEST(PlySuit, ChunkedRoundTrip) {
+    cv::Mat cloud = gridCloud(5, 7, {{3, 2}});
+    Mesh mesh;
+    GridMesher().triangulate(cloud, mesh);
+    const size_t vertices = mesh.vertices.size();
+    const size_t faces = mesh.triangles.size();
+
+    std::string path = (fs::temp_directory_path() / "chunked.ply").string();
+    {
+        PlyWriter writer(path);
+        // Faces before the last vertices, in uneven chunks
+        writer.writeVertices(mesh.vertices.data(), 10);
+        writer.writeFaces(mesh.triangles.data(), 3);
+        writer.writeFaces(mesh.triangles.data() + 3, faces - 3);
+        writer.writeVertices(mesh.vertices.data() + 10, vertices - 10);
+        writer.close();
+    }
+    EXPECT_FALSE(fs::exists(path + ".faces"));
+
+    std::ifstream file(path, std::ios::binary);
+    std::string line, header;
+    std::vector<std::string> elements;
+    while (std::getline(file, line)) {
+        header += line + "\n";
+        if (line.rfind("element ", 0) == 0) elements.push_back(line);
+        if (line == "end_header") break;
+    }
+    EXPECT_EQ(std::vector<std::string>(
+                  {"element vertex " + std::to_string(vertices),
+                   "element face " + std::to_string(faces)}),
+              elements);
+    EXPECT_EQ(header.size() + 15 * vertices + 13 * faces, fs::file_size(path));
+
+    // The first vertex and the last face as packed
+    float position[3];
+    file.read(reinterpret_cast<char *>(position), sizeof(position));
+    EXPECT_EQ(mesh.vertices[0][0], position[0]);
+    EXPECT_EQ(mesh.vertices[0][2], position[2]);
+    file.seekg(-12, std::ios::end);
+    int32_t face[3];
+    file.read(reinterpret_cast<char *>(face), sizeof(face));
+    EXPECT_EQ(mesh.triangles.back(), cv::Vec3i(face[0], face[1], face[2]));
+    file.close();
+
+    // Same bytes as the whole mesh at once
+    std::string whole = path + ".whole";
+    PlyWriter::write(whole, mesh);
+    std::ifstream chunked_file(path, std::ios::binary);
+    std::ifstream whole_file(whole, std::ios::binary);
+    EXPECT_TRUE(std::equal(std::istreambuf_iterator<char>(chunked_file), {},
+                           std::istreambuf_iterator<char>(whole_file), {}));
+    fs::remove(path);
+    fs::remove(whole);
+}
+
+TEST(MeshSuit, QuadtreeBump) {
+    // Tilted plane 1 m away with a bump of 5 cm in the middle
+    const int rows = 192, cols = 256;
+    const float max_error = 0.005f;
+    cv::Mat cloud(rows, cols, CV_32FC4);
+    auto depth = [&](int x, int y) {
+        float dx = (x - cols / 2) * 0.01f, dy = (y - rows / 2) * 0.01f;
+        return 1 + 0.002f * x + 0.05f * std::exp(-(dx * dx + dy * dy) / 0.05f);
+    };
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < cols; x++)
+            cloud.at<cv::Vec4f>(y, x) = {x * 0.01f, -y * 0.01f, -depth(x, y),
+                                         float(y * cols + x)};
+
+    QuadtreeMesher mesher({max_error, 64});
+    Mesh mesh;
+    mesher.triangulate(cloud, mesh);
+    std::vector<int> ids = vertexIds(cloud, mesh);
+
+    // Flat regions merge into far fewer triangles than the grid has
+    EXPECT_LT(mesh.triangles.size(), 2 * (rows - 1) * (cols - 1) / 10);
+
+    // Consistent winding uses every directed edge once, and every edge
+    // inside the grid in both directions, so two triangles share it
+    std::map<std::pair<int, int>, int> edges;
+    for (const cv::Vec3i &triangle : mesh.triangles)
+        for (int i = 0; i < 3; i++)
+            edges[{ids[triangle[i]], ids[triangle[(i + 1) % 3]]}]++;
+    for (auto [edge, count] : edges) {
+        EXPECT_EQ(1, count);
+        if (edges.count({edge.second, edge.first})) continue;
+        int x1 = edge.first % cols, y1 = edge.first / cols;
+        int x2 = edge.second % cols, y2 = edge.second / cols;
+        bool border = (x1 == x2 && (x1 == 0 || x1 == cols - 1)) ||
+                      (y1 == y2 && (y1 == 0 || y1 == rows - 1));
+        EXPECT_TRUE(border) << "open edge " << edge.first << " "
+                            << edge.second;
+    }
+
+    // Every point is covered and within the error bound of the surface,
+    // fans add at most the error of their centre
+    cv::Mat covered(rows, cols, CV_8U, cv::Scalar(0));
+    for (const cv::Vec3i &triangle : mesh.triangles) {
+        cv::Vec3f corners[3];
+        for (int i = 0; i < 3; i++)
+            corners[i] = {float(ids[triangle[i]] % cols),
+                          float(ids[triangle[i]] / cols),
+                          mesh.vertices[triangle[i]][2]};
+        cv::Vec3f u = corners[1] - corners[0], v = corners[2] - corners[0];
+        float area = u[0] * v[1] - u[1] * v[0];
+        ASSERT_NE(0, area);
+        int left = std::min({corners[0][0], corners[1][0], corners[2][0]});
+        int right = std::max({corners[0][0], corners[1][0], corners[2][0]});
+        int top = std::min({corners[0][1], corners[1][1], corners[2][1]});
+        int bottom = std::max({corners[0][1], corners[1][1], corners[2][1]});
+        for (int y = top; y <= bottom; y++) {
+            for (int x = left; x <= right; x++) {
+                float dx = x - corners[0][0], dy = y - corners[0][1];
+                float b = (dx * v[1] - dy * v[0]) / area;
+                float c = (u[0] * dy - u[1] * dx) / area;
+                if (b < 0 || c < 0 || b + c > 1) continue;
+                float z = corners[0][2] + b * u[2] + c * v[2];
+                EXPECT_NEAR(-depth(x, y), z, 2 * max_error);
+                covered.at<uchar>(y, x) = 1;
+            }
+        }
+    }
+    EXPECT_EQ(rows * cols, cv::countNonZero(covered));
+}
+
+TEST(PointCloudSuit, FilterFiniteKeepsRowOrder) {
+    // Rows of full, no, some and full finite points
+    cv::Mat cloud = gridCloud(4, 5, {{0, 1}, {1, 1}, {2, 1}, {3, 1}, {4, 1}});
+    cloud.at<cv::Vec4f>(2, 0)[0] = NAN;
+    cloud.at<cv::Vec4f>(2, 3)[1] = INFINITY;
+    cloud.at<cv::Vec4f>(2, 4)[2] = -INFINITY;
+
+    PointCloud points;
+    filterFinite(cloud, points);
+    std::vector<int> expected = {0, 1, 2, 3, 4, 11, 12, 15, 16, 17, 18, 19};
+    ASSERT_EQ(expected.size(), points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        const cv::Vec4f &point =
+            cloud.at<cv::Vec4f>(expected[i] / 5, expected[i] % 5);
+        EXPECT_EQ(point[0], points.x[i]);
+        EXPECT_EQ(point[1], points.y[i]);
+        EXPECT_EQ(point[2], points.z[i]);
+        EXPECT_EQ(std::bit_cast<uint32_t>(point[3]), points.rgba[i]);
+    }
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(points.x.data()) % 64);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(points.rgba.data()) % 64);
+}
+
+TEST(PointCloudSuit, VoxelCentroidAndColour) {
+    PointCloud points;
+    auto add = [&](float x, float y, float z, uint32_t rgba) {
+        points.x.push_back(x);
+        points.y.push_back(y);
+        points.z.push_back(z);
+        points.rgba.push_back(rgba);
+    };
+    // Two points in the first voxel, one left of the origin in the second
+    add(0.1f, 0.1f, 0.1f, 0x000a141eu);
+    add(-0.1f, 0.2f, 0.3f, 0xff808080u);
+    add(0.3f, 0.2f, 0.4f, 0x003d2814u);
+
+    VoxelGrid grid(0.5f);
+    PointCloud voxels;
+    grid.downsample(points, voxels);
+    ASSERT_EQ(2u, voxels.size());
+    EXPECT_FLOAT_EQ(0.2f, voxels.x[0]);
+    EXPECT_FLOAT_EQ(0.15f, voxels.y[0]);
+    EXPECT_FLOAT_EQ(0.25f, voxels.z[0]);
+    // Means per channel rounded half up, 35.5 blue becomes 36, opaque
+    EXPECT_EQ(0xff241e19u, voxels.rgba[0]);
+    EXPECT_FLOAT_EQ(-0.1f, voxels.x[1]);
+    EXPECT_EQ(0xff808080u, voxels.rgba[1]);
+}
+
+TEST(PointCloudSuit, VoxelKeyRange) {
+    // Voxel coordinates have to stay within 2^20 of the origin
+    PointCloud points;
+    for (float x : {1048576.0f, -1048576.0f, -1048575.0f, 1048575.0f, NAN,
+                    INFINITY}) {
+        points.x.push_back(x);
+        points.y.push_back(0);
+        points.z.push_back(0);
+        points.rgba.push_back(0);
+    }
+    points.y[3] = NAN;
+
+    VoxelGrid grid(1.0f);
+    PointCloud voxels;
+    grid.downsample(points, voxels);
+    ASSERT_EQ(1u, voxels.size());
+    EXPECT_EQ(-1048575.0f, voxels.x[0]);
+}
+
+TEST(ReplaySuit, RelativeTimestamps) {
+    fs::path directory = fs::temp_directory_path() / "replay_timestamps";
+    fs::create_directories(directory);
+    cv::Mat depth(4, 6, CV_8UC1, cv::Scalar(128));
+    for (int i = 0; i < 3; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "depth_%06d.png", i);
+        cv::imwrite((directory / name).string(), depth);
+    }
+    std::ofstream(directory / "timestamps.txt") << "1000\n1033\n1066\n";
+
+    Config config;
+    config.file_path = directory.string();
+    config.replay_max_speed = true;
+    ReplayFrameSource source(Printer{});
+    source.open(config);
+    EXPECT_EQ(std::vector<long long>({0, 33, 66}), source.timestamps());
+
+    SourceFrame frame;
+    int frames = 0;
+    while (source.grab() && source.retrieve(frame)) {
+        EXPECT_EQ(depth.size(), frame.depth.size());
+        frames++;
+    }
+    EXPECT_EQ(3, frames);
+    fs::remove_all(directory);
+}
+
+// Identical, noisy and sparsely changed frames across keyframes, for every
+// compression and a few frame formats. The metric view is asked for every
+// other frame, a recording delivers its depth view for it.
+TEST(ReplaySuit, RecordingRoundTrip) {
+    std::string path =
+        (fs::temp_directory_path() / "round_trip.dgtr").string();
+    const std::vector<std::pair<cv::Size, int>> formats = {
+        {{64, 48}, CV_8UC1}, {{37, 5}, CV_16UC1}, {{1, 1}, CV_8UC1}};
+
+    for (auto compression : {RecordingWriter::NONE, RecordingWriter::DELTA,
+                             RecordingWriter::bestCompression()}) {
+        for (const auto &[size, type] : formats) {
+            std::vector<cv::Mat> frames;
+            cv::Mat frame(size, type, cv::Scalar(0));
+            double high = type == CV_16UC1 ? 65536 : 256;
+            for (int i = 0; i < 2 * RecordingWriter::KEYFRAME_INTERVAL + 5;
+                 i++) {
+                if (i % 3 == 1) cv::randu(frame, 0, high);
+                if (i % 3 == 2) frame.row(i % size.height).setTo(cv::Scalar(i));
+                frames.push_back(frame.clone());
+            }
+
+            cv::Mat homography = cv::Mat::eye(3, 3, CV_64F);
+            homography.at<double>(0, 2) = 5;
+            {
+                RecordingWriter writer(path, compression);
+                writer.addCalibration(1, homography);
+                for (size_t i = 0; i < frames.size(); i++)
+                    writer.write(frames[i], 1000000 * i, 1);
+                cv::Mat taller(size.height + 1, size.width, type);
+                EXPECT_THROW(writer.write(taller, 0, 1), std::runtime_error);
+                writer.close();
+            }
+
+            Config config;
+            config.file_path = path;
+            config.replay_max_speed = true;
+            ReplayFrameSource source(Printer{});
+            source.open(config);
+            SourceFrame retrieved;
+            size_t read = 0;
+            while (source.grab()) {
+                uint32_t views = read % 2 ? FrameSource::METRIC_DEPTH
+                                          : FrameSource::DEPTH;
+                ASSERT_TRUE(source.retrieve(retrieved, views));
+                ASSERT_EQ(type, retrieved.depth.type());
+                ASSERT_EQ(size, retrieved.depth.size());
+                EXPECT_EQ(0, cv::norm(frames.at(read), retrieved.depth,
+                                      cv::NORM_INF))
+                    << "frame " << read << ", compression " << compression;
+                read++;
+            }
+            EXPECT_EQ(frames.size(), read);
+            EXPECT_EQ(0, cv::norm(homography, source.homography(),
+                                  cv::NORM_INF));
+        }
+    }
+    fs::remove(path);
+}
+
+// Gray camera view of the projector lighting up a quad, slightly blurred
+// so its corners come out rounded
+cv::Mat litQuad(const std::array<cv::Point2f, 4> &corners, int shift = 0) {
+    cv::Mat gray(480, 640, CV_8UC1);
+    cv::randu(gray, 20, 40);
+    std::vector<cv::Point> polygon;
+    for (const auto &corner : corners)
+        polygon.push_back(cv::Point(corner.x + shift, corner.y));
+    cv::fillConvexPoly(gray, polygon, cv::Scalar(220));
+    cv::GaussianBlur(gray, gray, {7, 7}, 0);
+    return gray;
+}
+
+TEST(CalibrationSuit, StableFramesAndBudget) {
+    const std::array<cv::Point2f, 4> corners = {
+        cv::Point2f(150, 100), {500, 120}, {480, 380}, {170, 360}};
+    cv::Mat gray = litQuad(corners);
+    cv::Mat moved = litQuad(corners, 40);
+    cv::Mat dark(480, 640, CV_8UC1, cv::Scalar(30));
+
+    CalibrationDetector::Parameters parameters;
+    parameters.budget = std::chrono::milliseconds(0);
+    parameters.stable_frames = 3;
+    CalibrationDetector detector(parameters);
+
+    // A detection that moved or vanished starts the count over
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(gray));
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(gray));
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(moved));
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(gray));
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(dark));
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(gray));
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(gray));
+    EXPECT_EQ(CalibrationDetector::CONVERGED, detector.feed(gray));
+    EXPECT_EQ(8, detector.frames());
+
+    // So does a rejected one
+    detector.reject();
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(gray));
+    EXPECT_EQ(CalibrationDetector::SEARCHING, detector.feed(gray));
+    EXPECT_EQ(CalibrationDetector::CONVERGED, detector.feed(gray));
+
+    // Out of time nothing is looked at any more
+    parameters.budget = std::chrono::milliseconds(1);
+    CalibrationDetector hurried(parameters);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_EQ(CalibrationDetector::TIMED_OUT, hurried.feed(gray));
+    EXPECT_EQ(0, hurried.frames());
+}
+
+TEST(CalibrationSuit, FitQuad) {
+    const std::array<cv::Point2f, 4> corners = {
+        cv::Point2f(150, 100), {500, 120}, {480, 380}, {170, 360}};
+    CalibrationDetector::Parameters parameters;
+    parameters.budget = std::chrono::milliseconds(0);
+    parameters.stable_frames = 1;
+    CalibrationDetector detector(parameters);
+    ASSERT_EQ(CalibrationDetector::CONVERGED,
+              detector.feed(litQuad(corners)));
+
+    // Clockwise from the top-left corner, at sub-pixel accuracy
+    QuadFit fit = fitQuad(detector.detection().mask);
+    ASSERT_TRUE(fit.good());
+    for (int i = 0; i < 4; i++) {
+        EXPECT_NEAR(corners.at(i).x, fit.corners.at(i).x, 1.5) << i;
+        EXPECT_NEAR(corners.at(i).y, fit.corners.at(i).y, 1.5) << i;
+    }
+    EXPECT_LT(fit.residual, 1.0);
+
+    // Three quarters of a square fit a quad, but not well enough
+    cv::Mat corner_shape = cv::Mat::zeros(480, 640, CV_8UC1);
+    corner_shape(cv::Rect(100, 100, 300, 300)).setTo(255);
+    corner_shape(cv::Rect(250, 100, 150, 150)).setTo(0);
+    QuadFit poor = fitQuad(corner_shape);
+    EXPECT_FALSE(poor.good());
+    EXPECT_LT(poor.score, QuadFit::MIN_SCORE);
+
+    EXPECT_FALSE(fitQuad(cv::Mat::zeros(480, 640, CV_8UC1)).found);
+}
+
+// Projection modes need no depth for segmentation, the reference a fresh
+// calibration is saved with still has to be taken from one
+TEST(CalibrationSuit, SavedWithoutSegmentation) {
+    InteractiveState state;
+    state.mode = InteractiveState::Mode::CHESS;
+    Config config;
+    config.record = false;
+    config.movement_every = 0;
+    bool save_calibration = false;
+    ViewDemand views = ViewDemand::capture(state, config, save_calibration);
+    EXPECT_EQ(0u, views.required(false));
+
+    save_calibration = true;
+    EXPECT_EQ(uint32_t(FrameSource::DEPTH), views.required(false));
+    EXPECT_EQ(uint32_t(FrameSource::METRIC_DEPTH), views.required(true));
+
+    // The first frame retrieved with those views becomes the reference
+    cv::Mat depth(72, 128, CV_8UC1);
+    cv::randu(depth, 0, 255);
+    MovementDetector movement;
+    movement.reset();
+    EXPECT_FALSE(movement.observe(depth));
+    ASSERT_TRUE(movement.hasReference());
+
+    CalibrationCache cache;
+    cache.serial = "12345";
+    cache.resolution = depth.size();
+    cache.homography = cv::Mat::eye(3, 3, CV_64F);
+    cache.roi = cv::Mat(depth.size(), CV_8UC1, cv::Scalar(255));
+    cache.reference = movement.reference();
+    std::string path =
+        (fs::temp_directory_path() / "calibration_cache.yml.gz").string();
+    cache.save(path);
+
+    CalibrationCache loaded;
+    ASSERT_TRUE(loaded.load(path));
+    EXPECT_EQ(cache.serial, loaded.serial);
+    EXPECT_EQ(0, cv::norm(cache.reference, loaded.reference, cv::NORM_INF));
+    EXPECT_TRUE(movement.matches(depth));
+    fs::remove(path);
+}
+
+std::string shmName(std::string test) {
+    return "dgt_test_" + test + "_" + std::to_string(getpid());
+}
+
+TEST(ShmSuit, RoundTrip) {
+    std::string name = shmName("round_trip");
+    auto publisher =
+        std::make_unique<ShmPublisher>(name, cv::Size(8, 6), 3, 2);
+    cv::Mat image(6, 8, CV_8UC3);
+    cv::randu(image, 0, 255);
+    ImageProcessor::MatWithInfo object;
+    object.area = 12;
+    object.mean_depth = 80;
+    object.bbox = {1, 2, 3, 4};
+    object.centroid = {2.5f, 4.0f};
+    auto captured = FrameTimestamps::clock::now();
+    ASSERT_TRUE(
+        publisher->publish(7, captured, image, {object, object, object}));
+
+    ShmReader reader(name);
+    EXPECT_EQ(1u, reader.published());
+    uint64_t frame_id = 0;
+    uint32_t count = 0;
+    ShmRing::ObjectInfo first{};
+    cv::Mat read;
+    ASSERT_TRUE(reader.readLatest([&](const ShmReader::View &view) {
+        frame_id = view.slot->frame_id;
+        count = view.slot->object_count;
+        first = view.objects[0];
+        read = cv::Mat(view.slot->height, view.slot->width, CV_8UC3,
+                       const_cast<uint8_t *>(view.pixels))
+                   .clone();
+    }));
+    EXPECT_EQ(7u, frame_id);
+    EXPECT_EQ(2u, count);  // max_objects
+    EXPECT_EQ(1u, first.id);
+    EXPECT_EQ(12u, first.area);
+    EXPECT_EQ(3, first.width);
+    EXPECT_FLOAT_EQ(80.0f, first.mean_depth);
+    EXPECT_EQ(0, cv::norm(image, read, cv::NORM_INF));
+    EXPECT_FALSE(reader.readLatest([](const ShmReader::View &) {}));
+
+    cv::Mat larger(7, 8, CV_8UC3);
+    EXPECT_FALSE(publisher->fits(larger));
+    EXPECT_FALSE(publisher->publish(8, captured, larger, {}));
+
+    EXPECT_FALSE(reader.retired());
+    publisher.reset();
+    EXPECT_TRUE(reader.retired());
+}
+
+TEST(ShmSuit, TornReadIsRetried) {
+    std::string name = shmName("torn");
+    ShmPublisher publisher(name, cv::Size(4, 4), 3, 0);
+    cv::Mat image(4, 4, CV_8UC3, cv::Scalar::all(1));
+    auto captured = FrameTimestamps::clock::now();
+    ASSERT_TRUE(publisher.publish(1, captured, image, {}));
+
+    // The publisher laps the reader while it is still in the slot
+    ShmReader reader(name);
+    EXPECT_FALSE(reader.readLatest([&](const ShmReader::View &) {
+        for (uint64_t id = 2; id <= 5; id++)
+            publisher.publish(id, captured, image, {});
+    }));
+    EXPECT_EQ(1u, reader.torn());
+
+    uint64_t frame_id = 0;
+    EXPECT_TRUE(reader.readLatest([&](const ShmReader::View &view) {
+        frame_id = view.slot->frame_id;
+    }));
+    EXPECT_EQ(5u, frame_id);
+    EXPECT_EQ(1u, reader.torn());
+}
+
+TEST(ShmSuit, WrappedRing) {
+    std::string name = shmName("wrapped");
+    ShmPublisher publisher(name, cv::Size(4, 4), 1, 1, 3);
+    ShmReader reader(name);
+    EXPECT_EQ(3u, reader.header().slot_count);
+
+    cv::Mat image(4, 4, CV_8UC1);
+    auto captured = FrameTimestamps::clock::now();
+    auto publish = [&](uint64_t first, uint64_t last) {
+        for (uint64_t n = first; n <= last; n++) {
+            image.setTo(cv::Scalar(double(n)));
+            ASSERT_TRUE(publisher.publish(n * 100, captured, image, {}));
+        }
+    };
+    uint64_t published = 0;
+    uint64_t frame_id = 0;
+    uint8_t pixel = 0;
+    auto readLatest = [&] {
+        return reader.readLatest([&](const ShmReader::View &view) {
+            published = view.slot->published;
+            frame_id = view.slot->frame_id;
+            pixel = view.pixels[15];
+        });
+    };
+
+    publish(1, 10);
+    ASSERT_TRUE(readLatest());
+    EXPECT_EQ(10u, published);
+    EXPECT_EQ(1000u, frame_id);
+    EXPECT_EQ(10, pixel);
+
+    publish(11, 14);
+    ASSERT_TRUE(readLatest());
+    EXPECT_EQ(14u, published);
+    EXPECT_EQ(14, pixel);
+    EXPECT_EQ(3u, reader.skipped());
+    EXPECT_EQ(0u, reader.torn());
+}
+
+// Unknown depth is 0, the near range saturates and everything else stays
+// in [1, max], or in the metric range for float output
+TEST(DepthQuantizerSuit, RangeAndUnknown) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    const float near = 0.3f;
+    const float far = 20.0f;
+    // unknown: NaN, +inf, 0 and beyond far; saturated: nearer and -inf
+    std::vector<float> values = {nan, inf, 0, 25, 0.1f, -inf};
+    for (int i = 0; i < 100; i++)
+        values.push_back(near + (far - near) * i / 100);
+    values.push_back(far);
+    cv::Mat depth(1, values.size(), CV_32FC1, values.data());
+    const int last = values.size() - 1;
+
+    for (auto mapping : {DepthQuantizer::LINEAR, DepthQuantizer::INVERSE}) {
+        for (int bits : {8, 16, 32}) {
+            DepthQuantizer quantizer({near, far, mapping, bits});
+            cv::Mat out;
+            quantizer.quantize(depth, out);
+            ASSERT_EQ(quantizer.outputType(), out.type());
+
+            auto at = [&](int x) -> double {
+                if (bits == 8) return out.at<uchar>(0, x);
+                if (bits == 16) return out.at<ushort>(0, x);
+                return out.at<float>(0, x);
+            };
+            double top = bits == 8 ? 255 : 65535;
+            double bottom = 1;
+            if (bits == 32) {
+                top = mapping == DepthQuantizer::INVERSE ? 1 / near - 1 / far
+                                                         : far - near;
+                bottom = 0;
+            }
+            double tolerance = bits == 32 ? 1e-5 * top : 0;
+
+            for (int x = 0; x < 4; x++) EXPECT_EQ(0, at(x)) << x;
+            EXPECT_NEAR(top, at(4), tolerance);
+            EXPECT_NEAR(top, at(5), tolerance);
+            EXPECT_NEAR(top, at(6), tolerance);
+            EXPECT_NEAR(bottom, at(last), tolerance);
+            for (int x = 7; x <= last; x++) {
+                EXPECT_GE(at(x), bottom) << x;
+                EXPECT_LE(at(x), at(x - 1)) << x;
+            }
+        }
+
+        // What the recorder makes of a float working image
+        DepthQuantizer metric({near, far, mapping, 32});
+        DepthQuantizer integer({near, far, mapping, 16});
+        cv::Mat working, expected, converted;
+        metric.quantize(depth, working);
+        integer.quantize(depth, expected);
+        metric.toInteger(working, 16, converted);
+        ASSERT_EQ(CV_16UC1, converted.type());
+        for (int x = 0; x <= last; x++)
+            EXPECT_NEAR(expected.at<ushort>(0, x), converted.at<ushort>(0, x),
+                        1)
+                << x;
+    }
+    EXPECT_THROW(DepthQuantizer({near, near, DepthQuantizer::LINEAR, 8}),
+                 std::runtime_error);
+    EXPECT_THROW(DepthQuantizer({near, far, DepthQuantizer::LINEAR, 12}),
+                 std::runtime_error);
+}
+
+TEST(TripleBufferSuit, LatestWins) {
+    TripleBuffer<int> buffer;
+    EXPECT_FALSE(buffer.update());
+    for (int value = 1; value <= 3; value++) {
+        buffer.writeBuffer() = value;
+        buffer.publish();
+    }
+    EXPECT_TRUE(buffer.update());
+    EXPECT_EQ(3, buffer.readBuffer());
+    EXPECT_FALSE(buffer.update());
+    EXPECT_EQ(3, buffer.readBuffer());
+
+    // Across threads values only move forward and arrive whole
+    struct Pair {
+        long first = 0;
+        long second = 0;
+    };
+    TripleBuffer<Pair> pairs;
+    const long last = 200000;
+    std::thread producer([&] {
+        for (long value = 1; value <= last; value++) {
+            pairs.writeBuffer() = {value, -value};
+            pairs.publish();
+        }
+    });
+    long seen = 0;
+    bool intact = true;
+    while (seen < last) {
+        if (!pairs.update()) continue;
+        const Pair &pair = pairs.readBuffer();
+        intact &= pair.first == -pair.second && pair.first > seen;
+        seen = pair.first;
+    }
+    producer.join();
+    EXPECT_TRUE(intact);
+    EXPECT_EQ(last, seen);
+}
+
+TEST(BoundedQueueSuit, LatestDropsOldest) {
+    BoundedQueue<int> queue(2, BoundedQueue<int>::LATEST);
+    for (int value = 1; value <= 5; value++) EXPECT_TRUE(queue.push(value));
+    EXPECT_EQ(2u, queue.size());
+    EXPECT_EQ(3u, queue.dropped());
+
+    int value = 0;
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(4, value);
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(5, value);
+}
+
+TEST(BoundedQueueSuit, BlockLosesNothing) {
+    BoundedQueue<int> queue(1, BoundedQueue<int>::BLOCK);
+    const int count = 10000;
+    std::atomic<size_t> largest{0};
+    std::thread producer([&] {
+        for (int value = 0; value < count; value++) {
+            queue.push(value);
+            largest = std::max(largest.load(), queue.size());
+        }
+        queue.close();
+    });
+
+    int value;
+    int expected = 0;
+    while (queue.pop(value)) EXPECT_EQ(expected++, value);
+    producer.join();
+    EXPECT_EQ(count, expected);
+    EXPECT_EQ(0u, queue.dropped());
+    EXPECT_LE(largest.load(), 1u);
+}
+
+// queue_depth is reloaded while the stages run
+TEST(BoundedQueueSuit, CapacityChangesLive) {
+    BoundedQueue<int> latest(4, BoundedQueue<int>::LATEST);
+    for (int value = 1; value <= 4; value++) latest.push(value);
+    latest.setCapacity(2);
+    latest.push(5);
+    EXPECT_EQ(2u, latest.size());
+    int value = 0;
+    EXPECT_TRUE(latest.pop(value));
+    EXPECT_EQ(4, value);
+
+    // A producer waiting on a full queue goes on once it grows
+    BoundedQueue<int> block(1, BoundedQueue<int>::BLOCK);
+    block.push(1);
+    std::thread producer([&] { EXPECT_TRUE(block.push(2)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    block.setCapacity(2);
+    producer.join();
+    EXPECT_EQ(2u, block.size());
+}
+
+TEST(BoundedQueueSuit, CloseWakesBothSides) {
+    // A consumer waiting on an empty queue
+    BoundedQueue<int> empty(1, BoundedQueue<int>::BLOCK);
+    std::thread consumer([&] {
+        int value;
+        EXPECT_FALSE(empty.pop(value));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    empty.close();
+    consumer.join();
+
+    // A producer waiting on a full one; what was queued is still drained
+    BoundedQueue<int> full(1, BoundedQueue<int>::BLOCK);
+    EXPECT_TRUE(full.push(1));
+    std::thread producer([&] { EXPECT_FALSE(full.push(2)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    full.close();
+    producer.join();
+
+    int value = 0;
+    EXPECT_TRUE(full.pop(value));
+    EXPECT_EQ(1, value);
+    EXPECT_FALSE(full.pop(value));
+    EXPECT_FALSE(full.push(3));
+}
+
+TEST(EventBusSuit, NoLostWakeup) {
+    EventBus events(Printer(Printer::DEBUG_LVL::PRODUCTION));
+    int ping = events.subscribe("ping");
+    int pong = events.subscribe("pong");
+
+    // Posted before anybody waits, still pending
+    events.post(EventBus::FRAME_GRABBED);
+    EXPECT_EQ(EventBus::FRAME_GRABBED,
+              events.wait(ping, EventBus::FRAME_GRABBED));
+    EXPECT_EQ(EventBus::NONE, events.poll(ping, EventBus::FRAME_GRABBED));
+    EXPECT_EQ(EventBus::FRAME_GRABBED,
+              events.poll(pong, EventBus::FRAME_GRABBED));
+
+    // Every round depends on the other thread's wakeup, a lost one stalls
+    const int rounds = 5000;
+    const auto timeout = std::chrono::seconds(5);
+    std::atomic<int> answered{0};
+    std::thread responder([&] {
+        for (int i = 0; i < rounds; i++) {
+            if (events.waitFor(pong, EventBus::FRAME_GRABBED, timeout) ==
+                EventBus::NONE)
+                return;
+            answered++;
+            events.post(EventBus::RESULT_READY);
+        }
+    });
+    int stalled = 0;
+    for (int i = 0; i < rounds; i++) {
+        events.post(EventBus::FRAME_GRABBED);
+        if (events.waitFor(ping, EventBus::RESULT_READY, timeout) ==
+            EventBus::NONE) {
+            stalled++;
+            break;
+        }
+    }
+    responder.join();
+    EXPECT_EQ(0, stalled);
+    EXPECT_EQ(rounds, answered.load());
+
+    // Shutdown stays pending for every later wait
+    events.post(EventBus::SHUTDOWN);
+    EXPECT_EQ(EventBus::SHUTDOWN, events.wait(ping, EventBus::SHUTDOWN));
+    EXPECT_EQ(EventBus::SHUTDOWN, events.poll(ping, EventBus::SHUTDOWN));
+}
+
+TEST(ThreadPoolSuit, ParallelForCoversEachIndexOnce) {
+    ThreadPool pool(4);
+    for (int count : {1, 7, 1000, 10007}) {
+        for (int grain : {1, 3, 64, 20000}) {
+            std::vector<std::atomic<int>> hits(count);
+            pool.parallelFor(
+                count,
+                [&](int begin, int end) {
+                    for (int i = begin; i < end; i++) hits[i]++;
+                },
+                ThreadPool::NORMAL, grain);
+            int wrong = 0;
+            for (const auto &hit : hits) wrong += hit != 1;
+            EXPECT_EQ(0, wrong) << count << " by " << grain;
+        }
+    }
+
+    // Nested loops finish and still cover everything once
+    std::vector<std::atomic<int>> cells(64 * 64);
+    pool.parallelFor(64, [&](int row_begin, int row_end) {
+        for (int row = row_begin; row < row_end; row++)
+            pool.parallelFor(64, [&](int begin, int end) {
+                for (int column = begin; column < end; column++)
+                    cells[row * 64 + column]++;
+            });
+    });
+    int wrong = 0;
+    for (const auto &cell : cells) wrong += cell != 1;
+    EXPECT_EQ(0, wrong);
+}
+
+TEST(QualitySuit, StepsDownAndBackUp) {
+    std::vector<QualityLevel> ladder(3);
+    ladder[1].scale = 0.5f;
+    ladder[2].scale = 0.25f;
+    QualityController quality(Printer(Printer::DEBUG_LVL::PRODUCTION), ladder,
+                              10);
+    const std::chrono::microseconds slow(20000);
+    const std::chrono::microseconds fast(2000);
+
+    for (int i = 0; i < 4; i++) quality.observe(slow);
+    EXPECT_EQ(0, quality.levelIndex());
+    quality.observe(slow);
+    EXPECT_EQ(1, quality.levelIndex());
+    EXPECT_EQ(0.5f, quality.level().scale);
+
+    for (int i = 0; i < 59; i++) quality.observe(fast);
+    EXPECT_EQ(1, quality.levelIndex());
+    quality.observe(fast);
+    EXPECT_EQ(0, quality.levelIndex());
+
+    // Neither end of the ladder is passed
+    for (int i = 0; i < 60; i++) quality.observe(fast);
+    EXPECT_EQ(0, quality.levelIndex());
+    for (int i = 0; i < 50; i++) quality.observe(slow);
+    EXPECT_EQ(2, quality.levelIndex());
+
+    // Without a target the best level is kept
+    quality.setLadder(ladder, 0);
+    EXPECT_EQ(0, quality.levelIndex());
+    for (int i = 0; i < 10; i++) quality.observe(slow);
+    EXPECT_EQ(0, quality.levelIndex());
+}